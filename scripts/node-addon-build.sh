@@ -0,0 +1,5 @@
+#!/bin/sh
+mkdir -p build-node
+(cd build-node && cmake -DBUILD_NODE_ADDON=ON -DCMAKE_C_FLAGS="-march=native" ..) &&
+(cd build-node && make VERBOSE=1 -j ${nprocs} openjpegjs-node) &&
+(cd test/node; npm run test:native)
@@ -8,4 +8,8 @@ mkdir -p build
 (cd build && emmake make VERBOSE=1 -j) &&
 cp ./build/extern/openjpeg/bin/openjpegjs.js ./dist &&
 cp ./build/extern/openjpeg/bin/openjpegjs.wasm ./dist &&
-(cd test/node; npm run test)
+cp ./build/extern/openjpeg/bin/openjpegjs-decoder.js ./dist &&
+cp ./build/extern/openjpeg/bin/openjpegjs-decoder.wasm ./dist &&
+cp ./build/extern/openjpeg/bin/openjpegjs-memory.js ./dist &&
+cp ./build/extern/openjpeg/bin/openjpegjs-memory.wasm ./dist &&
+(cd test/node; npm run test && npm run test:decoder)
@@ -5,15 +5,34 @@
 
 #include "openjpeg.h"
 
+typedef OPJ_BOOL (*opj_buffer_cancelled_fn) (void* client_data);
+
 typedef struct opj_buffer_info {
     OPJ_BYTE* buf;
     OPJ_BYTE* cur;
     OPJ_SIZE_T len;
+    /* optional - polled on every read/write, returning OPJ_TRUE makes the
+       stream fail so openjp2 stops decoding/encoding */
+    opj_buffer_cancelled_fn cancelled;
+    void* client_data;
 } opj_buffer_info_t;
 
+/* stream chunk size used when a cancellation callback is set so openjp2
+   calls back into the stream (and the callback gets polled) more often */
+#define OPJ_BUFFER_CANCELLABLE_CHUNK_SIZE 0x10000
+
+static OPJ_BOOL
+opj_buffer_is_cancelled (opj_buffer_info_t* psrc)
+{
+    return psrc->cancelled && psrc->cancelled (psrc->client_data);
+}
+
 static OPJ_SIZE_T
 opj_read_from_buffer (void* pdst, OPJ_SIZE_T len, opj_buffer_info_t* psrc)
 {
+    if (opj_buffer_is_cancelled (psrc))
+        return (OPJ_SIZE_T)-1;
+
     OPJ_SIZE_T n = psrc->buf + psrc->len - psrc->cur;
 
     if (n) {
@@ -33,10 +52,13 @@ static OPJ_SIZE_T
 opj_write_to_buffer (void* p_buffer, OPJ_SIZE_T p_nb_bytes,
                      opj_buffer_info_t* p_source_buffer)
 {
-    OPJ_BYTE* pbuf = p_source_buffer->buf;
-    OPJ_BYTE* pcur = p_source_buffer->cur;
+    if (opj_buffer_is_cancelled (p_source_buffer))
+        return (OPJ_SIZE_T)-1;
 
-    OPJ_SIZE_T len = p_source_buffer->len;
+    /* fail instead of writing past the end of the buffer */
+    OPJ_SIZE_T n = p_source_buffer->buf + p_source_buffer->len - p_source_buffer->cur;
+    if (p_nb_bytes > n)
+        return (OPJ_SIZE_T)-1;
 
     memcpy (p_source_buffer->cur, p_buffer, p_nb_bytes);
     p_source_buffer->cur += p_nb_bytes;
@@ -44,19 +66,31 @@ opj_write_to_buffer (void* p_buffer, OPJ_SIZE_T p_nb_bytes,
     return p_nb_bytes;
 }
 
-static OPJ_SIZE_T
-opj_skip_from_buffer (OPJ_SIZE_T len, opj_buffer_info_t* psrc)
+static OPJ_OFF_T
+opj_skip_from_buffer (OPJ_OFF_T len, opj_buffer_info_t* psrc)
 {
+    if (opj_buffer_is_cancelled (psrc))
+        return (OPJ_OFF_T)-1;
+
+    /* skips stay within the buffer, backwards too */
+    if (len < 0) {
+        OPJ_SIZE_T back = psrc->cur - psrc->buf;
+        if ((OPJ_SIZE_T)-len > back)
+            return (OPJ_OFF_T)-1;
+        psrc->cur += len;
+        return len;
+    }
+
     OPJ_SIZE_T n = psrc->buf + psrc->len - psrc->cur;
 
     if (n) {
-        if (n > len)
+        if (n > (OPJ_SIZE_T)len)
             n = len;
 
-        psrc->cur += len;
+        psrc->cur += n;
     }
     else
-        n = (OPJ_SIZE_T)-1;
+        return (OPJ_OFF_T)-1;
 
     return n;
 }
@@ -66,7 +100,10 @@ opj_seek_from_buffer (OPJ_OFF_T len, opj_buffer_info_t* psrc)
 {
     OPJ_SIZE_T n = psrc->len;
 
-    if (n > len)
+    if (len < 0)
+        return OPJ_FALSE;
+
+    if (n > (OPJ_SIZE_T)len)
         n = len;
 
     psrc->cur = psrc->buf + n;
@@ -80,7 +117,9 @@ opj_stream_create_buffer_stream (opj_buffer_info_t* psrc, OPJ_BOOL input)
     if (!psrc)
         return 0;
 
-    opj_stream_t* ps = opj_stream_default_create (input);
+    opj_stream_t* ps = psrc->cancelled ?
+        opj_stream_create (OPJ_BUFFER_CANCELLABLE_CHUNK_SIZE, input) :
+        opj_stream_default_create (input);
 
     if (0 == ps)
         return 0;
@@ -0,0 +1,148 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "openjpeg.h"
+
+/// <summary>
+/// Cooperative cancellation state for a decode or encode.  cancel() may be
+/// called from any thread, the codec polls isCancelled() at the points where
+/// openjp2 hands control back to us: stream reads/writes and between the
+/// decode/encode phases.  openjp2 reads the bitstream of a tiled image tile
+/// by tile, so a decode stops before the next tile; the T1/DWT decode of a
+/// tile (all of a single tile image) runs to completion before the
+/// cancellation is seen.
+/// Operations are numbered, cancel() applies to the running operation or,
+/// if none is running, to the next one and finish() makes a request that
+/// was not seen in time stale so it never cancels a later operation.
+/// </summary>
+class CancellationToken {
+  public:
+  CancellationToken() :
+    operation_(0),
+    cancelledOperation_(UINT64_MAX),
+    depth_(0),
+    timeLimit_(0)
+  {
+  }
+
+  /// <summary>
+  /// Ends the operation (calls finish()) when it goes out of scope, declared
+  /// at the top of each public decode/encode method.  Scopes nest: a public
+  /// method called by another one is part of the caller's operation, which
+  /// only ends when the outermost Scope does.
+  /// </summary>
+  class Scope {
+    public:
+    explicit Scope(CancellationToken& token) : token_(token) {
+      token_.depth_++;
+    }
+    ~Scope() {
+      if(--token_.depth_ == 0) {
+        token_.finish();
+      }
+    }
+
+    private:
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+      CancellationToken& token_;
+  };
+
+  /// <summary>
+  /// Requests that the current operation, or the next one if none is
+  /// running, stops as soon as possible
+  /// </summary>
+  void cancel() {
+    cancelledOperation_ = operation_.load();
+  }
+
+  /// <summary>
+  /// Requests that the given operation (see getOperation()) stops, does
+  /// nothing if it already finished
+  /// </summary>
+  void cancel(uint64_t operation) {
+    cancelledOperation_ = operation;
+  }
+
+  /// <summary>
+  /// Returns the number of the running operation, or the next one if none
+  /// is running
+  /// </summary>
+  uint64_t getOperation() const {
+    return operation_;
+  }
+
+  /// <summary>
+  /// Sets the maximum time in milliseconds an operation may run before it is
+  /// cancelled, 0 = no limit
+  /// </summary>
+  void setTimeLimit(double milliseconds) {
+    timeLimit_ = milliseconds;
+  }
+
+  /// <summary>
+  /// Returns the time limit in milliseconds, 0 = no limit
+  /// </summary>
+  double getTimeLimit() const {
+    return timeLimit_;
+  }
+
+  /// <summary>
+  /// Called when an operation (or a phase with its own time limit) begins -
+  /// starts the time limit.  A pending cancel() is kept.
+  /// </summary>
+  void start() {
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  /// <summary>
+  /// Called when an operation has finished, a cancel() for it that was not
+  /// seen no longer applies
+  /// </summary>
+  void finish() {
+    operation_++;
+  }
+
+  /// <summary>
+  /// Returns the time in milliseconds since start()
+  /// </summary>
+  double elapsed() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+  }
+
+  /// <summary>
+  /// Returns true if cancel() was called
+  /// </summary>
+  bool isCancelRequested() const {
+    return cancelledOperation_ == operation_;
+  }
+
+  /// <summary>
+  /// Returns true if cancel() was called or the time limit expired
+  /// </summary>
+  bool isCancelled() const {
+    return isCancelRequested() || (timeLimit_ > 0 && elapsed() >= timeLimit_);
+  }
+
+  /// <summary>
+  /// opj_buffer_info_t cancellation callback, client_data is the token
+  /// </summary>
+  static OPJ_BOOL cancelledCallback(void* client_data) {
+    return ((const CancellationToken*)client_data)->isCancelled() ? OPJ_TRUE : OPJ_FALSE;
+  }
+
+  private:
+    std::atomic<uint64_t> operation_;
+    std::atomic<uint64_t> cancelledOperation_;
+    // number of open Scopes, only used by the thread running the operation
+    size_t depth_;
+    double timeLimit_;
+    std::chrono::steady_clock::time_point start_;
+};
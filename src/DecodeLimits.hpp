@@ -0,0 +1,50 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+
+/// <summary>
+/// Resource limits for decoding untrusted bitstreams, see
+/// J2KDecoder::setLimits().  0 = no limit for every field.  A decode over a
+/// limit fails with J2KStatus::LimitExceeded.
+/// </summary>
+struct DecodeLimits {
+    /// <summary>
+    /// Maximum image width * height in the SIZ marker
+    /// </summary>
+    size_t maxPixels;
+
+    /// <summary>
+    /// Maximum number of components in the SIZ marker
+    /// </summary>
+    size_t maxComponents;
+
+    /// <summary>
+    /// Maximum number of tiles in the SIZ marker
+    /// </summary>
+    size_t maxTiles;
+
+    /// <summary>
+    /// Maximum bytes of component planes, tile workspace and decoded buffer
+    /// for the requested decomposition level, computed from the SIZ marker
+    /// </summary>
+    size_t maxMemory;
+
+    /// <summary>
+    /// Maximum time in milliseconds a decode may take.  It is checked when
+    /// openjp2 reads the bitstream, i.e. before each tile; the decode of a
+    /// single tile (all of an untiled image) is not interrupted, bound that
+    /// work up front with maxCodeBlocks and maxPixels.
+    /// </summary>
+    double maxDecodeTime;
+
+    /// <summary>
+    /// Maximum number of code-blocks to entropy decode for the requested
+    /// decomposition level, estimated from the SIZ and COD markers before
+    /// decoding (components x decoded bands x code-blocks per band, plus
+    /// the partial blocks at tile edges)
+    /// </summary>
+    size_t maxCodeBlocks;
+};
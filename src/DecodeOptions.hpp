@@ -0,0 +1,23 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+
+/// <summary>
+/// Options for J2KDecoder::decodeFrame(), the arguments of
+/// decodeSubResolution().  Zero initialized it decodes everything at full
+/// resolution like decode().
+/// </summary>
+struct DecodeOptions {
+    /// <summary>
+    /// Number of decomposition levels to skip, 0 = full resolution
+    /// </summary>
+    size_t decompositionLevel;
+
+    /// <summary>
+    /// Number of quality layers to decode, 0 = all
+    /// </summary>
+    size_t decodeLayer;
+};
@@ -0,0 +1,52 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/val.h>
+#endif
+
+#include "FrameInfo.hpp"
+#include "J2KStatus.hpp"
+#include "Point.hpp"
+#include "Size.hpp"
+
+/// <summary>
+/// Everything the individual J2KDecoder getters return after a decode,
+/// gathered so JavaScript gets it in one call (see
+/// J2KDecoder::decodeFrame() and J2KDecoder::getDecodeResult())
+/// </summary>
+struct DecodeResult {
+    /// <summary>
+    /// Status of the decode, see J2KDecoder::getStatus()
+    /// </summary>
+    J2KStatus status;
+
+    /// <summary>
+    /// The decoded image, see J2KDecoder::getFrameInfo()
+    /// </summary>
+    FrameInfo frameInfo;
+
+    size_t numDecompositions;
+    bool isReversible;
+    bool isHighThroughput;
+    int progressionOrder;
+    Point imageOffset;
+    Size tileSize;
+    Point tileOffset;
+    Size blockDimensions;
+    int32_t numLayers;
+    size_t colorSpace;
+
+#ifdef __EMSCRIPTEN__
+    /// <summary>
+    /// TypedArray of the decoded buffer in WASM memory space, valid until
+    /// the next decode like getDecodedBuffer()
+    /// </summary>
+    emscripten::val pixelData = emscripten::val::undefined();
+#endif
+};
@@ -0,0 +1,316 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "J2KDecoder.hpp"
+
+/// <summary>
+/// Priority classes for DecodeScheduler jobs, lower values are decoded first
+/// </summary>
+enum class DecodePriority {
+    /// <summary>
+    /// The frame currently on screen
+    /// </summary>
+    Visible = 0,
+
+    /// <summary>
+    /// Frames next to the visible frame that will likely be shown next
+    /// </summary>
+    Adjacent = 1,
+
+    /// <summary>
+    /// Background prefetch
+    /// </summary>
+    Prefetch = 2
+};
+
+/// <summary>
+/// Decodes J2K bitstreams on a pool of threads in priority order.  Queued
+/// jobs can be reprioritized (e.g. when the visible frame changes) and when
+/// all threads are busy, a job of higher priority preempts the lowest
+/// priority running job.  Preemption uses J2KDecoder::cancel() so it takes
+/// effect at the next tile boundary; only jobs with more than one tile are
+/// preempted, a single tile decode cannot be interrupted before it has done
+/// all its work.  A preempted job goes back in the queue at its original
+/// position and is decoded again from the start, unless it finished before
+/// it saw the cancellation.
+/// This class is not exported to JavaScript, it is intended to be used by
+/// native C++ code.
+/// </summary>
+class DecodeScheduler {
+  public:
+  /// <summary>
+  /// Called on a worker thread when a job finishes.  decoder holds the
+  /// decoded pixels and image properties; it is reused for the next job so
+  /// the callback must consume them before returning.  decoder.getStatus()
+  /// is Cancelled if the job was cancelled while running.
+  /// </summary>
+  typedef std::function<void(size_t jobId, J2KDecoder& decoder)> Callback;
+
+  /// <summary>
+  /// Constructor, starts numThreads worker threads
+  /// </summary>
+  DecodeScheduler(size_t numThreads) :
+    nextId_(1),
+    numCallbacks_(0),
+    numPreemptions_(0),
+    stopping_(false)
+  {
+    for(size_t i = 0; i < (numThreads ? numThreads : 1); i++) {
+      workers_.push_back(std::thread(&DecodeScheduler::run_, this));
+    }
+  }
+
+  /// <summary>
+  /// Destructor, cancels running jobs, discards queued jobs and joins the
+  /// worker threads
+  /// </summary>
+  ~DecodeScheduler() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+      for(size_t i = 0; i < running_.size(); i++) {
+        running_[i].decoder->cancelOperation(running_[i].operation);
+      }
+    }
+    workAvailable_.notify_all();
+    for(size_t i = 0; i < workers_.size(); i++) {
+      workers_[i].join();
+    }
+  }
+
+  /// <summary>
+  /// Queues a bitstream for decoding at the given decomposition level and
+  /// returns the job id.  The bitstream is decoded in place, it must remain
+  /// valid until the callback for this job has been called.
+  /// </summary>
+  size_t submit(const uint8_t* encoded, size_t encodedSize, size_t decompositionLevel, DecodePriority priority, Callback callback) {
+    size_t jobId;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobId = nextId_++;
+      Job& job = jobs_[jobId];
+      job.encoded = encoded;
+      job.encodedSize = encodedSize;
+      job.decompositionLevel = decompositionLevel;
+      job.priority = priority;
+      job.sequence = jobId;
+      job.callback = callback;
+      job.numTiles = J2KDecoder::countTiles(encoded, encodedSize);
+      job.running = false;
+      job.preempted = false;
+      job.cancelled = false;
+      queue_.insert(Key(job.priority, job.sequence, jobId));
+      preempt_(priority);
+    }
+    workAvailable_.notify_one();
+    return jobId;
+  }
+
+  /// <summary>
+  /// Changes the priority of a job.  Raising a queued job above the running
+  /// jobs may preempt one of them.  Returns false if the job has finished.
+  /// </summary>
+  bool setPriority(size_t jobId, DecodePriority priority) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<size_t, Job>::iterator it = jobs_.find(jobId);
+    if(it == jobs_.end()) {
+      return false;
+    }
+    Job& job = it->second;
+    if(job.running) {
+      job.priority = priority;
+      for(size_t i = 0; i < running_.size(); i++) {
+        if(running_[i].jobId == jobId) {
+          running_[i].priority = priority;
+        }
+      }
+      return true;
+    }
+    queue_.erase(Key(job.priority, job.sequence, jobId));
+    job.priority = priority;
+    queue_.insert(Key(job.priority, job.sequence, jobId));
+    preempt_(priority);
+    return true;
+  }
+
+  /// <summary>
+  /// Cancels a job.  A queued job is removed without calling its callback, a
+  /// running job stops at the next tile boundary and its callback is called
+  /// with the decoder status Cancelled.  Returns false if the job has
+  /// finished.
+  /// </summary>
+  bool cancel(size_t jobId) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<size_t, Job>::iterator it = jobs_.find(jobId);
+    if(it == jobs_.end()) {
+      return false;
+    }
+    Job& job = it->second;
+    if(job.running) {
+      job.cancelled = true;
+      for(size_t i = 0; i < running_.size(); i++) {
+        if(running_[i].jobId == jobId) {
+          running_[i].decoder->cancelOperation(running_[i].operation);
+        }
+      }
+      return true;
+    }
+    queue_.erase(Key(job.priority, job.sequence, jobId));
+    jobs_.erase(it);
+    if(jobs_.empty() && numCallbacks_ == 0) {
+      idle_.notify_all();
+    }
+    return true;
+  }
+
+  /// <summary>
+  /// Blocks until all submitted jobs have finished
+  /// </summary>
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return jobs_.empty() && numCallbacks_ == 0; });
+  }
+
+  /// <summary>
+  /// returns the number of times a running job was stopped and requeued for
+  /// a job of higher priority
+  /// </summary>
+  size_t getNumPreemptions() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return numPreemptions_;
+  }
+
+  private:
+    struct Job {
+      const uint8_t* encoded;
+      size_t encodedSize;
+      size_t decompositionLevel;
+      DecodePriority priority;
+      size_t sequence;
+      Callback callback;
+      size_t numTiles;
+      bool running;
+      bool preempted; // cancelled for a job of higher priority
+      bool cancelled;
+    };
+
+    struct Running {
+      size_t jobId;
+      DecodePriority priority;
+      J2KDecoder* decoder;
+      uint64_t operation; // J2KDecoder::getOperation() of the job's decode
+    };
+
+    // queue order - priority, then submission order
+    struct Key {
+      Key(DecodePriority priority, size_t sequence, size_t jobId) : priority(priority), sequence(sequence), jobId(jobId) {}
+      bool operator<(const Key& rhs) const {
+        if(priority != rhs.priority) {
+          return priority < rhs.priority;
+        }
+        return sequence < rhs.sequence;
+      }
+      DecodePriority priority;
+      size_t sequence;
+      size_t jobId;
+    };
+
+    // called with mutex_ held after a job of the given priority was queued
+    void preempt_(DecodePriority priority) {
+      if(running_.size() < workers_.size()) {
+        return; // a worker is idle
+      }
+      Running* victim = NULL;
+      for(size_t i = 0; i < running_.size(); i++) {
+        Job& job = jobs_[running_[i].jobId];
+        if(running_[i].priority > priority && job.numTiles > 1 && !job.preempted && !job.cancelled &&
+            (!victim || running_[i].priority > victim->priority)) {
+          victim = &running_[i];
+        }
+      }
+      if(victim) {
+        // counted when the decode returns Cancelled, it may finish first
+        jobs_[victim->jobId].preempted = true;
+        victim->decoder->cancelOperation(victim->operation);
+      }
+    }
+
+    void run_() {
+      J2KDecoder decoder;
+      std::unique_lock<std::mutex> lock(mutex_);
+      while(true) {
+        workAvailable_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if(stopping_) {
+          return;
+        }
+        const size_t jobId = queue_.begin()->jobId;
+        queue_.erase(queue_.begin());
+        Job& job = jobs_[jobId];
+        job.running = true;
+        Running running = { jobId, job.priority, &decoder, decoder.getOperation() };
+        running_.push_back(running);
+        const uint8_t* encoded = job.encoded;
+        const size_t encodedSize = job.encodedSize;
+        const size_t decompositionLevel = job.decompositionLevel;
+        lock.unlock();
+
+        decoder.setEncodedBytes(encoded, encodedSize);
+        decoder.decodeSubResolution(decompositionLevel, 0);
+
+        lock.lock();
+        for(size_t i = 0; i < running_.size(); i++) {
+          if(running_[i].jobId == jobId) {
+            running_.erase(running_.begin() + i);
+            break;
+          }
+        }
+        Job& finished = jobs_[jobId];
+        finished.running = false;
+        const bool preempted = finished.preempted;
+        finished.preempted = false;
+        if(decoder.getStatus() == J2KStatus::Cancelled && preempted && !finished.cancelled && !stopping_) {
+          // back in the queue at its original position
+          numPreemptions_++;
+          queue_.insert(Key(finished.priority, finished.sequence, jobId));
+          workAvailable_.notify_one();
+          continue;
+        }
+        Callback callback = finished.callback;
+        jobs_.erase(jobId);
+        numCallbacks_++;
+        lock.unlock();
+
+        if(callback) {
+          callback(jobId, decoder);
+        }
+
+        lock.lock();
+        numCallbacks_--;
+        if(jobs_.empty() && numCallbacks_ == 0) {
+          idle_.notify_all();
+        }
+      }
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable workAvailable_;
+    std::condition_variable idle_;
+    std::vector<std::thread> workers_;
+    std::map<size_t, Job> jobs_;
+    std::set<Key> queue_;
+    std::vector<Running> running_;
+    size_t nextId_;
+    size_t numCallbacks_;
+    size_t numPreemptions_;
+    bool stopping_;
+};
@@ -0,0 +1,205 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Severity of a Diagnostic, the openjp2 message levels
+/// </summary>
+enum class DiagnosticLevel {
+    Error = 0,
+    Warning = 1,
+    Info = 2
+};
+
+/// <summary>
+/// What a Diagnostic is about
+/// </summary>
+enum class DiagnosticCode {
+    /// <summary>
+    /// A message from openjp2, see Diagnostic::message
+    /// </summary>
+    OpenJPEG = 0,
+
+    /// <summary>
+    /// openjp2 rejected the decoder/encoder parameters
+    /// </summary>
+    SetupFailed = 1,
+
+    /// <summary>
+    /// The main header could not be read
+    /// </summary>
+    HeaderFailed = 2,
+
+    /// <summary>
+    /// Decoding the tiles failed
+    /// </summary>
+    DecodeFailed = 3,
+
+    /// <summary>
+    /// Encoding failed
+    /// </summary>
+    EncodeFailed = 4,
+
+    /// <summary>
+    /// The bitstream exceeds a DecodeLimits limit
+    /// </summary>
+    LimitExceeded = 5,
+
+    /// <summary>
+    /// The bitstream needs a feature this build of openjp2 lacks
+    /// </summary>
+    Unsupported = 6,
+
+    /// <summary>
+    /// A file, or the DICOM encapsulated pixel data around the codestreams,
+    /// could not be read
+    /// </summary>
+    ReadFailed = 7
+};
+
+/// <summary>
+/// One message recorded by Diagnostics
+/// </summary>
+struct Diagnostic {
+    DiagnosticLevel level;
+    DiagnosticCode code;
+    std::string message;
+};
+
+/// <summary>
+/// Per decoder/encoder record of the openjp2 messages and the errors of the
+/// last operation: counters per level and the most recent messages in a
+/// bounded ring buffer.  Nothing is printed unless a verbosity is set, so
+/// streams that make openjp2 emit many warnings do not pay for console
+/// output (a synchronous write per message in WASM).
+/// </summary>
+class Diagnostics {
+  public:
+  /// <summary>
+  /// Constructor, keeps the last capacity messages
+  /// </summary>
+  Diagnostics(size_t capacity = 16) :
+    entries_(capacity),
+    next_(0),
+    size_(0),
+    verbosity_(0)
+  {
+    clear();
+  }
+
+  /// <summary>
+  /// Sets the levels also printed to stdout: 0 = none (default), 1 = errors,
+  /// 2 = errors and warnings, 3 = everything
+  /// </summary>
+  void setVerbosity(size_t verbosity) {
+    verbosity_ = verbosity;
+  }
+
+  /// <summary>
+  /// returns the verbosity set with setVerbosity()
+  /// </summary>
+  size_t getVerbosity() const {
+    return verbosity_;
+  }
+
+  /// <summary>
+  /// Forgets the messages and resets the counters, called at the start of
+  /// each operation
+  /// </summary>
+  void clear() {
+    next_ = 0;
+    size_ = 0;
+    for(size_t i = 0; i < 3; i++) {
+      counts_[i] = 0;
+    }
+  }
+
+  /// <summary>
+  /// Records a message, a trailing newline is dropped
+  /// </summary>
+  void add(DiagnosticLevel level, DiagnosticCode code, const char* message) {
+    counts_[(size_t)level]++;
+    if((size_t)level < verbosity_) {
+      static const char* labels[] = {"[ERROR]", "[WARNING]", "[INFO]"};
+      printf("%s %s%s", labels[(size_t)level], message, endsWithNewline_(message) ? "" : "\n");
+    }
+    if(entries_.empty()) {
+      return;
+    }
+    // assigning to the existing entry reuses its string buffer
+    Diagnostic& entry = entries_[next_];
+    entry.level = level;
+    entry.code = code;
+    entry.message.assign(message, strlen(message) - (endsWithNewline_(message) ? 1 : 0));
+    next_ = (next_ + 1) % entries_.size();
+    size_ = std::min(size_ + 1, entries_.size());
+  }
+
+  /// <summary>
+  /// Records a printf style message
+  /// </summary>
+  void addf(DiagnosticLevel level, DiagnosticCode code, const char* format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    add(level, code, message);
+  }
+
+  /// <summary>
+  /// returns the number of messages recorded at level since clear(),
+  /// including the ones no longer in the ring buffer
+  /// </summary>
+  size_t getCount(DiagnosticLevel level) const {
+    return counts_[(size_t)level];
+  }
+
+  /// <summary>
+  /// returns the number of messages in the ring buffer
+  /// </summary>
+  size_t size() const {
+    return size_;
+  }
+
+  /// <summary>
+  /// returns a message in the ring buffer, 0 is the oldest
+  /// </summary>
+  const Diagnostic& get(size_t index) const {
+    return entries_[(next_ + entries_.size() - size_ + index) % entries_.size()];
+  }
+
+  /// <summary>
+  /// openjp2 message handlers, client_data is the Diagnostics
+  /// </summary>
+  static void errorCallback(const char* msg, void* client_data) {
+    ((Diagnostics*)client_data)->add(DiagnosticLevel::Error, DiagnosticCode::OpenJPEG, msg);
+  }
+  static void warningCallback(const char* msg, void* client_data) {
+    ((Diagnostics*)client_data)->add(DiagnosticLevel::Warning, DiagnosticCode::OpenJPEG, msg);
+  }
+  static void infoCallback(const char* msg, void* client_data) {
+    ((Diagnostics*)client_data)->add(DiagnosticLevel::Info, DiagnosticCode::OpenJPEG, msg);
+  }
+
+  private:
+    static bool endsWithNewline_(const char* message) {
+      const size_t length = strlen(message);
+      return length > 0 && message[length - 1] == '\n';
+    }
+
+    std::vector<Diagnostic> entries_;
+    size_t next_;
+    size_t size_;
+    size_t counts_[3];
+    size_t verbosity_;
+};
@@ -0,0 +1,361 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Diagnostics.hpp"
+#include "J2KDecoder.hpp"
+
+/// <summary>
+/// Random access to the frames of DICOM encapsulated pixel data
+/// (PS3.5 A.4).  The pixel data is memory mapped (or provided by the caller)
+/// and indexed once from the Basic Offset Table, or by scanning the fragment
+/// items when the Basic Offset Table is empty, so a frame can be handed to
+/// J2KDecoder without parsing or copying the items that precede it.  Errors
+/// are recorded like the codecs' (getNumErrors(), getDiagnostic()) rather
+/// than printed.  This class is not exported to JavaScript, it is intended
+/// to be called by C++ code
+/// </summary>
+class EncapsulatedFrameReader {
+  public:
+  /// <summary>
+  /// Constructor for an empty reader, see open() and setBytes()
+  /// </summary>
+  EncapsulatedFrameReader() :
+  data_(NULL),
+  size_(0),
+  map_(NULL),
+  mapSize_(0)
+  {
+  }
+
+  ~EncapsulatedFrameReader() {
+    close();
+  }
+
+  EncapsulatedFrameReader(const EncapsulatedFrameReader&) = delete;
+  EncapsulatedFrameReader& operator=(const EncapsulatedFrameReader&) = delete;
+
+  /// <summary>
+  /// Memory maps the file and indexes the encapsulated pixel data starting
+  /// at offset (the Pixel Data element tag, or the Basic Offset Table item
+  /// tag).  numberOfFrames is the value of Number of Frames (0028,0008) and
+  /// is only needed when the Basic Offset Table is empty, 0 = unknown.
+  /// Returns false if the file cannot be mapped or the pixel data is not
+  /// encapsulated, see getDiagnostic() for the reason.
+  /// </summary>
+  bool open(const std::string& path, size_t offset = 0, size_t numberOfFrames = 0) {
+    close();
+    diagnostics_.clear();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+      diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: failed to open %s", path.c_str());
+      return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size <= offset) {
+      diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: %s is too small", path.c_str());
+      ::close(fd);
+      return false;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED) {
+      diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: failed to map %s", path.c_str());
+      return false;
+    }
+    map_ = map;
+    mapSize_ = st.st_size;
+    return setBytes((const uint8_t*)map_ + offset, mapSize_ - offset, numberOfFrames);
+  }
+
+  /// <summary>
+  /// Indexes encapsulated pixel data in caller owned memory, which must
+  /// remain valid while frames are being read.  See open() for the
+  /// parameters.
+  /// </summary>
+  bool setBytes(const uint8_t* data, size_t size, size_t numberOfFrames = 0) {
+    diagnostics_.clear();
+    if(data < (const uint8_t*)map_ || data >= (const uint8_t*)map_ + mapSize_) {
+      close();
+    }
+    data_ = data;
+    size_ = size;
+    fragments_.clear();
+    frames_.clear();
+    if(!index_(numberOfFrames)) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  /// <summary>
+  /// Unmaps the file and clears the frame index
+  /// </summary>
+  void close() {
+    if(map_) {
+      munmap(map_, mapSize_);
+    }
+    map_ = NULL;
+    mapSize_ = 0;
+    data_ = NULL;
+    size_ = 0;
+    fragments_.clear();
+    frames_.clear();
+    std::vector<uint8_t>().swap(scratch_);
+  }
+
+  /// <summary>
+  /// returns the number of frames in the index
+  /// </summary>
+  size_t getNumFrames() const {
+    return frames_.size();
+  }
+
+  /// <summary>
+  /// returns the number of fragments that make up a frame
+  /// </summary>
+  size_t getNumFragments(size_t frame) const {
+    return frame < frames_.size() ? frames_[frame].numFragments : 0;
+  }
+
+  /// <summary>
+  /// Returns the codestream for a frame.  Single fragment frames point
+  /// directly into the pixel data, frames split across several fragments are
+  /// joined into a scratch buffer that is reused by the next call.  Returns
+  /// false if the frame does not exist.
+  /// </summary>
+  bool getFrame(size_t frame, const uint8_t*& data, size_t& size) {
+    if(frame >= frames_.size()) {
+      diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: frame %zu out of range (%zu frames)", frame, frames_.size());
+      return false;
+    }
+    const Frame& f = frames_[frame];
+    const Fragment& first = fragments_[f.firstFragment];
+    if(f.numFragments == 1) {
+      data = data_ + first.offset;
+      size = first.length;
+      return true;
+    }
+    size_t length = 0;
+    for(size_t i = 0; i < f.numFragments; i++) {
+      length += fragments_[f.firstFragment + i].length;
+    }
+    scratch_.resize(length);
+    size_t position = 0;
+    for(size_t i = 0; i < f.numFragments; i++) {
+      const Fragment& fragment = fragments_[f.firstFragment + i];
+      memcpy(&scratch_[position], data_ + fragment.offset, fragment.length);
+      position += fragment.length;
+    }
+    data = scratch_.data();
+    size = length;
+    return true;
+  }
+
+  /// <summary>
+  /// Points the decoder at a frame without copying it (see
+  /// J2KDecoder::setEncodedBytes()).  The decoder must not be used after the
+  /// reader is closed, or after the next call to setFrame()/getFrame() if the
+  /// frame spans several fragments.
+  /// </summary>
+  bool setFrame(J2KDecoder& decoder, size_t frame) {
+    const uint8_t* data;
+    size_t size;
+    if(!getFrame(frame, data, size)) {
+      return false;
+    }
+    decoder.setEncodedBytes(data, size);
+    return true;
+  }
+
+  /// <summary>
+  /// Sets which messages are also printed to stdout: 0 = none (default),
+  /// 1 = errors, 2 = errors and warnings
+  /// </summary>
+  void setVerbosity(size_t verbosity) {
+    diagnostics_.setVerbosity(verbosity);
+  }
+
+  /// <summary>
+  /// returns the number of messages kept from the last open()/setBytes()
+  /// and the getFrame() calls since, the most recent 16
+  /// </summary>
+  size_t getNumDiagnostics() const {
+    return diagnostics_.size();
+  }
+
+  /// <summary>
+  /// returns a kept message, 0 is the oldest
+  /// </summary>
+  Diagnostic getDiagnostic(size_t index) const {
+    if(index < diagnostics_.size()) {
+      return diagnostics_.get(index);
+    }
+    return Diagnostic();
+  }
+
+  /// <summary>
+  /// returns the number of errors since the last open()/setBytes()
+  /// </summary>
+  size_t getNumErrors() const {
+    return diagnostics_.getCount(DiagnosticLevel::Error);
+  }
+
+  /// <summary>
+  /// returns the number of warnings since the last open()/setBytes(), a
+  /// frame count that does not match numberOfFrames
+  /// </summary>
+  size_t getNumWarnings() const {
+    return diagnostics_.getCount(DiagnosticLevel::Warning);
+  }
+
+  private:
+
+    struct Fragment {
+      size_t offset; // of the fragment value, relative to data_
+      size_t length;
+    };
+
+    struct Frame {
+      size_t firstFragment;
+      size_t numFragments;
+    };
+
+    static uint16_t readUint16_(const uint8_t* p) {
+      return p[0] | (p[1] << 8);
+    }
+
+    static uint32_t readUint32_(const uint8_t* p) {
+      return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static bool isItem_(const uint8_t* p) {
+      return readUint16_(p) == 0xFFFE && readUint16_(p + 2) == 0xE000;
+    }
+
+    static bool isSequenceDelimiter_(const uint8_t* p) {
+      return readUint16_(p) == 0xFFFE && readUint16_(p + 2) == 0xE0DD;
+    }
+
+    static bool startsCodestream_(const uint8_t* p, size_t length) {
+      // SOC followed by SIZ, or a JP2 signature box
+      return length >= 4 && ((p[0] == 0xFF && p[1] == 0x4F && p[2] == 0xFF && p[3] == 0x51) ||
+        (length >= 8 && memcmp(p + 4, "jP  ", 4) == 0));
+    }
+
+    bool index_(size_t numberOfFrames) {
+      size_t position = 0;
+
+      // skip the Pixel Data (7FE0,0010) element header if present:
+      // tag, VR, reserved and undefined length (explicit VR little endian)
+      if(size_ >= 12 && readUint16_(data_) == 0x7FE0 && readUint16_(data_ + 2) == 0x0010) {
+        if(readUint32_(data_ + 8) != 0xFFFFFFFF) {
+          diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: pixel data is not encapsulated");
+          return false;
+        }
+        position = 12;
+      }
+
+      // Basic Offset Table
+      if(position + 8 > size_ || !isItem_(data_ + position)) {
+        diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: missing Basic Offset Table item");
+        return false;
+      }
+      const size_t botLength = readUint32_(data_ + position + 4);
+      const uint8_t* bot = data_ + position + 8;
+      position += 8 + botLength;
+      if(position > size_ || botLength % 4) {
+        diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: invalid Basic Offset Table");
+        return false;
+      }
+
+      // fragment items up to the sequence delimiter, the Basic Offset Table
+      // offsets are relative to the first fragment item
+      const size_t firstItem = position;
+      std::vector<size_t> itemOffsets;
+      while(position + 8 <= size_ && !isSequenceDelimiter_(data_ + position)) {
+        if(!isItem_(data_ + position)) {
+          diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: invalid fragment item at offset %zu", position);
+          return false;
+        }
+        const size_t length = readUint32_(data_ + position + 4);
+        if(position + 8 + length > size_) {
+          diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: fragment at offset %zu is truncated", position);
+          return false;
+        }
+        itemOffsets.push_back(position - firstItem);
+        fragments_.push_back({position + 8, length});
+        position += 8 + length;
+      }
+      if(fragments_.empty()) {
+        diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: no fragments");
+        return false;
+      }
+
+      if(botLength) {
+        // a frame is every fragment from its offset up to the next frame's
+        const size_t numFrames = botLength / 4;
+        size_t fragment = 0;
+        for(size_t i = 0; i < numFrames; i++) {
+          const size_t offset = readUint32_(bot + i * 4);
+          while(fragment < itemOffsets.size() && itemOffsets[fragment] < offset) {
+            fragment++;
+          }
+          if(fragment == itemOffsets.size() || itemOffsets[fragment] != offset) {
+            diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: Basic Offset Table entry %zu does not point at a fragment", i);
+            return false;
+          }
+          frames_.push_back({fragment, 1});
+        }
+        for(size_t i = 0; i < numFrames; i++) {
+          const size_t end = (i + 1 < numFrames) ? frames_[i + 1].firstFragment : fragments_.size();
+          frames_[i].numFragments = end - frames_[i].firstFragment;
+        }
+      } else if(numberOfFrames == fragments_.size() || numberOfFrames == 1) {
+        // one fragment per frame, or a single frame split across fragments
+        if(numberOfFrames == 1) {
+          frames_.push_back({0, fragments_.size()});
+        } else {
+          for(size_t i = 0; i < fragments_.size(); i++) {
+            frames_.push_back({i, 1});
+          }
+        }
+      } else {
+        // no offsets, a frame starts at each fragment beginning with a
+        // codestream
+        for(size_t i = 0; i < fragments_.size(); i++) {
+          const Fragment& fragment = fragments_[i];
+          if(frames_.empty() || startsCodestream_(data_ + fragment.offset, fragment.length)) {
+            frames_.push_back({i, 1});
+          } else {
+            frames_.back().numFragments++;
+          }
+        }
+        if(numberOfFrames && frames_.size() != numberOfFrames) {
+          diagnostics_.addf(DiagnosticLevel::Warning, DiagnosticCode::ReadFailed, "EncapsulatedFrameReader: found %zu frames, expected %zu", frames_.size(), numberOfFrames);
+        }
+      }
+      return true;
+    }
+
+    const uint8_t* data_;
+    size_t size_;
+    void* map_;
+    size_t mapSize_;
+    std::vector<Fragment> fragments_;
+    std::vector<Frame> frames_;
+    std::vector<uint8_t> scratch_;
+    Diagnostics diagnostics_;
+};
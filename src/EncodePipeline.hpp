@@ -0,0 +1,231 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "J2KEncoder.hpp"
+
+/// <summary>
+/// Encodes raw frames on a pool of threads and delivers the encoded
+/// bitstreams in submission order.  The raw bytes of queued and running
+/// frames and the encoded bytes waiting for an earlier frame to finish are
+/// bounded: submit() blocks the producer until enough frames have been
+/// delivered to make room.  This class is not exported to JavaScript, it is
+/// intended to be used by native C++ code.
+/// </summary>
+class EncodePipeline {
+  public:
+  /// <summary>
+  /// Called for each frame in submission order, on whichever worker thread
+  /// finished the frame that was holding up delivery.  Calls never overlap.
+  /// encoded is only valid during the call.  status is the J2KEncoder
+  /// status of the frame.
+  /// </summary>
+  typedef std::function<void(size_t frame, const std::vector<uint8_t>& encoded, J2KStatus status)> Callback;
+
+  /// <summary>
+  /// Called on a worker thread before each encode to apply the encoder
+  /// settings (quality, decompositions, preset...)
+  /// </summary>
+  typedef std::function<void(J2KEncoder& encoder)> Configure;
+
+  /// <summary>
+  /// Constructor, starts numThreads worker threads.  maxRawBytes and
+  /// maxEncodedBytes bound the bytes in flight, 0 = unbounded.  A frame
+  /// larger than a bound is still accepted when nothing else is in flight.
+  /// </summary>
+  EncodePipeline(size_t numThreads, size_t maxRawBytes, size_t maxEncodedBytes,
+                 Callback callback, Configure configure = Configure()) :
+    callback_(callback),
+    configure_(configure),
+    maxRawBytes_(maxRawBytes),
+    maxEncodedBytes_(maxEncodedBytes),
+    rawBytes_(0),
+    encodedBytes_(0),
+    nextFrame_(0),
+    nextDelivery_(0),
+    delivering_(false),
+    stopping_(false)
+  {
+    for(size_t i = 0; i < (numThreads ? numThreads : 1); i++) {
+      workers_.push_back(std::thread(&EncodePipeline::run_, this));
+    }
+  }
+
+  /// <summary>
+  /// Destructor, finishes and delivers the submitted frames and joins the
+  /// worker threads
+  /// </summary>
+  ~EncodePipeline() {
+    wait();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    workAvailable_.notify_all();
+    for(size_t i = 0; i < workers_.size(); i++) {
+      workers_[i].join();
+    }
+  }
+
+  EncodePipeline(const EncodePipeline&) = delete;
+  EncodePipeline& operator=(const EncodePipeline&) = delete;
+
+  /// <summary>
+  /// Queues a raw frame described by frameInfo for encoding and returns its
+  /// frame number (0, 1, 2...).  Blocks while the raw or encoded bytes in
+  /// flight are over their bounds.  The pipeline takes ownership of raw.
+  /// </summary>
+  size_t submit(std::vector<uint8_t>&& raw, const FrameInfo& frameInfo) {
+    size_t frame;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      const size_t size = raw.size();
+      roomAvailable_.wait(lock, [this, size] { return hasRoom_(size); });
+      frame = nextFrame_++;
+      Job& job = jobs_[frame];
+      job.raw.swap(raw);
+      job.frameInfo = frameInfo;
+      job.status = J2KStatus::Ok;
+      job.done = false;
+      rawBytes_ += size;
+      queue_.push_back(frame);
+    }
+    workAvailable_.notify_one();
+    return frame;
+  }
+
+  /// <summary>
+  /// Blocks until all submitted frames have been delivered
+  /// </summary>
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return jobs_.empty() && !delivering_; });
+  }
+
+  /// <summary>
+  /// returns the raw bytes of queued and running frames
+  /// </summary>
+  size_t getRawBytesInFlight() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rawBytes_;
+  }
+
+  /// <summary>
+  /// returns the encoded bytes waiting for delivery
+  /// </summary>
+  size_t getEncodedBytesInFlight() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return encodedBytes_;
+  }
+
+  private:
+    struct Job {
+      std::vector<uint8_t> raw;
+      FrameInfo frameInfo;
+      std::vector<uint8_t> encoded;
+      J2KStatus status;
+      bool done;
+    };
+
+    // called with mutex_ held
+    bool hasRoom_(size_t size) const {
+      if(jobs_.empty()) {
+        return true;
+      }
+      return (maxRawBytes_ == 0 || rawBytes_ + size <= maxRawBytes_) &&
+             (maxEncodedBytes_ == 0 || encodedBytes_ <= maxEncodedBytes_);
+    }
+
+    void run_() {
+      J2KEncoder encoder;
+      std::unique_lock<std::mutex> lock(mutex_);
+      while(true) {
+        workAvailable_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if(stopping_) {
+          return;
+        }
+        const size_t frame = queue_.front();
+        queue_.pop_front();
+        Job& job = jobs_[frame];
+        const uint8_t* raw = job.raw.data();
+        const size_t rawSize = job.raw.size();
+        const FrameInfo frameInfo = job.frameInfo;
+        lock.unlock();
+
+        // std::map references stay valid while other frames are added and
+        // this frame is only erased after it is done
+        encoder.setDecodedBytes(raw, rawSize, frameInfo);
+        if(configure_) {
+          configure_(encoder);
+        }
+        encoder.encode();
+        std::vector<uint8_t> encoded(encoder.getEncodedBytes());
+
+        lock.lock();
+        job.encoded.swap(encoded);
+        job.status = encoder.getStatus();
+        job.done = true;
+        std::vector<uint8_t>().swap(job.raw);
+        rawBytes_ -= rawSize;
+        encodedBytes_ += job.encoded.size();
+        roomAvailable_.notify_all();
+        deliver_(lock);
+      }
+    }
+
+    // Delivers finished frames in order.  Only one thread delivers at a
+    // time, frames finished meanwhile are picked up by the same loop.
+    void deliver_(std::unique_lock<std::mutex>& lock) {
+      if(delivering_) {
+        return;
+      }
+      delivering_ = true;
+      while(true) {
+        std::map<size_t, Job>::iterator it = jobs_.find(nextDelivery_);
+        if(it == jobs_.end() || !it->second.done) {
+          break;
+        }
+        Job& job = it->second;
+        lock.unlock();
+        if(callback_) {
+          callback_(nextDelivery_, job.encoded, job.status);
+        }
+        lock.lock();
+        encodedBytes_ -= job.encoded.size();
+        jobs_.erase(it);
+        nextDelivery_++;
+        roomAvailable_.notify_all();
+      }
+      delivering_ = false;
+      if(jobs_.empty()) {
+        idle_.notify_all();
+      }
+    }
+
+    Callback callback_;
+    Configure configure_;
+    mutable std::mutex mutex_;
+    std::condition_variable workAvailable_;
+    std::condition_variable roomAvailable_;
+    std::condition_variable idle_;
+    std::vector<std::thread> workers_;
+    std::map<size_t, Job> jobs_;
+    std::deque<size_t> queue_;
+    size_t maxRawBytes_;
+    size_t maxEncodedBytes_;
+    size_t rawBytes_;
+    size_t encodedBytes_;
+    size_t nextFrame_;
+    size_t nextDelivery_;
+    bool delivering_;
+    bool stopping_;
+};
@@ -0,0 +1,47 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// <summary>
+/// Memory and cost estimate for a decode or encode computed from the header
+/// (or FrameInfo) only, see J2KDecoder::estimateDecode() and
+/// J2KEncoder::estimateEncode().  Byte counts saturate at SIZE_MAX.
+/// </summary>
+struct Estimate {
+    /// <summary>
+    /// Bitstream bytes held during the operation: the encoded buffer plus
+    /// openjp2's copy of the tile data when decoding, the output buffer when
+    /// encoding
+    /// </summary>
+    size_t encodedBytes;
+
+    /// <summary>
+    /// Bytes of the int32 opj_image_t component planes
+    /// </summary>
+    size_t imageBytes;
+
+    /// <summary>
+    /// Bytes of openjp2 tile, code-block and wavelet workspace
+    /// </summary>
+    size_t workspaceBytes;
+
+    /// <summary>
+    /// Bytes of native samples (the decoded buffer)
+    /// </summary>
+    size_t decodedBytes;
+
+    /// <summary>
+    /// Peak bytes, the sum of the above
+    /// </summary>
+    size_t totalBytes;
+
+    /// <summary>
+    /// Relative cost, one unit is roughly one sample through the wavelet
+    /// transform; every coded byte adds 8 units for entropy coding
+    /// </summary>
+    double cost;
+};
@@ -0,0 +1,404 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef OPENJPEGJS_USE_IO_URING
+#include <liburing.h>
+#endif
+
+#include "J2KDecoder.hpp"
+
+/// <summary>
+/// Decodes a list of J2K/JP2 files in order on the calling thread while the
+/// next readAhead files are read in the background, so reading frame N+k
+/// overlaps decoding frame N instead of the CPU waiting for the disk and
+/// the disk for the CPU.  Reads are submitted to io_uring when built with
+/// OPENJPEGJS_USE_IO_URING (link liburing) and the kernel supports opening,
+/// sizing and reading files in the ring (5.6 or later), otherwise they run
+/// on a pool of reader threads.  This class is not
+/// exported to JavaScript, it is intended to be used by native C++ code.
+/// </summary>
+class FileBatchDecoder {
+  public:
+  /// <summary>
+  /// Called on the calling thread for each file in list order.  decoder
+  /// holds the decoded pixels and image properties; it is reused for the
+  /// next file so the callback must consume them before returning.  status
+  /// is Failed if the file could not be read (nothing was decoded),
+  /// otherwise decoder.getStatus().
+  /// </summary>
+  typedef std::function<void(size_t index, J2KDecoder& decoder, J2KStatus status)> Callback;
+
+  /// <summary>
+  /// Constructor.  readAhead is the number of files read ahead of the one
+  /// being decoded, 0 = read then decode each file synchronously.
+  /// numReaders is the number of reader threads when io_uring is not used.
+  /// </summary>
+  FileBatchDecoder(size_t readAhead, size_t numReaders) :
+    slots_(readAhead + 1),
+    useIoUring_(false),
+    stopping_(false),
+    ioWaitMS_(0),
+    decodeMS_(0),
+    bytesRead_(0)
+  {
+#ifdef OPENJPEGJS_USE_IO_URING
+    // at most two submissions per slot (open and statx, then the read),
+    // short reads are resubmitted after the completion is consumed
+    useIoUring_ = io_uring_queue_init((unsigned)slots_.size() * 2, &ring_, 0) == 0;
+    if(useIoUring_) {
+      io_uring_probe* probe = io_uring_get_probe_ring(&ring_);
+      useIoUring_ = probe &&
+        io_uring_opcode_supported(probe, IORING_OP_OPENAT) &&
+        io_uring_opcode_supported(probe, IORING_OP_STATX) &&
+        io_uring_opcode_supported(probe, IORING_OP_READ);
+      if(probe) {
+        io_uring_free_probe(probe);
+      }
+      if(!useIoUring_) {
+        io_uring_queue_exit(&ring_);
+      }
+    }
+#endif
+    if(!useIoUring_) {
+      for(size_t i = 0; i < (numReaders ? numReaders : 1); i++) {
+        readers_.push_back(std::thread(&FileBatchDecoder::run_, this));
+      }
+    }
+  }
+
+  /// <summary>
+  /// Destructor, joins the reader threads
+  /// </summary>
+  ~FileBatchDecoder() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    readAvailable_.notify_all();
+    for(size_t i = 0; i < readers_.size(); i++) {
+      readers_[i].join();
+    }
+#ifdef OPENJPEGJS_USE_IO_URING
+    if(useIoUring_) {
+      io_uring_queue_exit(&ring_);
+    }
+#endif
+  }
+
+  FileBatchDecoder(const FileBatchDecoder&) = delete;
+  FileBatchDecoder& operator=(const FileBatchDecoder&) = delete;
+
+  /// <summary>
+  /// Returns the decoder so the caller can configure it (threads, limits,
+  /// statistics...) before calling decode()
+  /// </summary>
+  J2KDecoder& getDecoder() {
+    return decoder_;
+  }
+
+  /// <summary>
+  /// Reads and decodes paths in order, calling callback after each decode.
+  /// Blocks until every file has been decoded.
+  /// </summary>
+  void decode(const std::vector<std::string>& paths, Callback callback) {
+    typedef std::chrono::steady_clock Clock;
+    ioWaitMS_ = 0;
+    decodeMS_ = 0;
+    bytesRead_ = 0;
+    size_t started = 0;
+    for(size_t i = 0; i < paths.size(); i++) {
+      // keep files i to i + readAhead in flight, the slot of file i - 1 is
+      // free again now that its callback returned
+      while(started < paths.size() && started < i + slots_.size()) {
+        startRead_(started, paths[started]);
+        started++;
+      }
+
+      const Clock::time_point start = Clock::now();
+      waitRead_(i);
+      const Clock::time_point read = Clock::now();
+      ioWaitMS_ += std::chrono::duration<double, std::milli>(read - start).count();
+
+      Slot& slot = slot_(i);
+      J2KStatus status = J2KStatus::Failed;
+      if(slot.ok) {
+        bytesRead_ += slot.data.size();
+        decoder_.setEncodedBytes(slot.data.data(), slot.data.size());
+        status = decoder_.decode();
+        decodeMS_ += std::chrono::duration<double, std::milli>(Clock::now() - read).count();
+      }
+      if(callback) {
+        callback(i, decoder_, status);
+      }
+    }
+  }
+
+  /// <summary>
+  /// returns "io_uring" or "threads", the way files are read
+  /// </summary>
+  const char* getBackend() const {
+    return useIoUring_ ? "io_uring" : "threads";
+  }
+
+  /// <summary>
+  /// returns the milliseconds the last decode() waited for files to be
+  /// read, close to 0 when reading keeps up with decoding
+  /// </summary>
+  double getIOWaitMS() const {
+    return ioWaitMS_;
+  }
+
+  /// <summary>
+  /// returns the milliseconds the last decode() spent decoding
+  /// </summary>
+  double getDecodeMS() const {
+    return decodeMS_;
+  }
+
+  /// <summary>
+  /// returns the bytes read by the last decode()
+  /// </summary>
+  uint64_t getBytesRead() const {
+    return bytesRead_;
+  }
+
+  private:
+    struct Slot {
+      Slot() : index(0), fd(-1), filled(0), pending(0), failed(false), done(true), ok(false) {}
+      std::string path;
+      std::vector<uint8_t> data;
+      size_t index;
+      int fd;
+      size_t filled;
+      size_t pending;
+      bool failed;
+      bool done;
+      bool ok;
+#ifdef OPENJPEGJS_USE_IO_URING
+      struct statx stat;
+#endif
+    };
+
+#ifdef OPENJPEGJS_USE_IO_URING
+    // io_uring requests of a slot, the user data of a request is
+    // index * NumRequests + request
+    enum Request {
+      Open,
+      Stat,
+      Read,
+      NumRequests
+    };
+#endif
+
+    Slot& slot_(size_t index) {
+      return slots_[index % slots_.size()];
+    }
+
+    void startRead_(size_t index, const std::string& path) {
+      if(!useIoUring_) {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          Slot& slot = slot_(index);
+          slot.path = path;
+          slot.index = index;
+          slot.done = false;
+          slot.ok = false;
+          queue_.push_back(index);
+        }
+        readAvailable_.notify_one();
+        return;
+      }
+#ifdef OPENJPEGJS_USE_IO_URING
+      // the file is opened and sized in the ring as well so the decode
+      // thread never blocks on open() or fstat() of a cold file, the read
+      // is submitted when both have completed
+      Slot& slot = slot_(index);
+      slot.path = path;
+      slot.index = index;
+      slot.fd = -1;
+      slot.filled = 0;
+      slot.pending = 0;
+      slot.failed = !prepare_(slot, Open) || !prepare_(slot, Stat);
+      slot.done = false;
+      slot.ok = false;
+      submit_();
+      advance_(slot);
+#endif
+    }
+
+    void waitRead_(size_t index) {
+      if(!useIoUring_) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Slot& slot = slot_(index);
+        readDone_.wait(lock, [&slot] { return slot.done; });
+        return;
+      }
+#ifdef OPENJPEGJS_USE_IO_URING
+      // completions arrive in any order, the ones for later files are
+      // recorded (or resubmitted when short) on the way
+      Slot& slot = slot_(index);
+      while(!slot.done) {
+        submit_();
+        io_uring_cqe* cqe = NULL;
+        const int waited = io_uring_wait_cqe(&ring_, &cqe);
+        if(waited == -EINTR) {
+          continue;
+        }
+        if(waited < 0) {
+          finishRead_(slot, false);
+          break;
+        }
+        const size_t data = (size_t)(uintptr_t)io_uring_cqe_get_data(cqe);
+        const int result = cqe->res;
+        io_uring_cqe_seen(&ring_, cqe);
+        Slot& completed = slot_(data / NumRequests);
+        completed.pending--;
+        if(result < 0 || (data % NumRequests == Read && result == 0)) {
+          completed.failed = true;
+        } else if(data % NumRequests == Open) {
+          completed.fd = result;
+        } else if(data % NumRequests == Stat) {
+          completed.data.resize(completed.stat.stx_size);
+        } else {
+          completed.filled += result;
+        }
+        advance_(completed);
+      }
+#endif
+    }
+
+#ifdef OPENJPEGJS_USE_IO_URING
+    // Queues a request for slot, returns false if the ring is full
+    bool prepare_(Slot& slot, Request request) {
+      io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+      if(!sqe) {
+        return false;
+      }
+      if(request == Open) {
+        io_uring_prep_openat(sqe, AT_FDCWD, slot.path.c_str(), O_RDONLY, 0);
+      } else if(request == Stat) {
+        io_uring_prep_statx(sqe, AT_FDCWD, slot.path.c_str(), 0, STATX_SIZE, &slot.stat);
+      } else {
+        // the kernel reads at most about 2GB per request, the rest is read
+        // by the resubmissions of short reads
+        const size_t length = std::min<size_t>(slot.data.size() - slot.filled, 1u << 30);
+        io_uring_prep_read(sqe, slot.fd, slot.data.data() + slot.filled, (unsigned)length, slot.filled);
+      }
+      io_uring_sqe_set_data(sqe, (void*)(uintptr_t)(slot.index * NumRequests + request));
+      slot.pending++;
+      return true;
+    }
+
+    // Submits the queued requests, a request that could not be submitted
+    // now stays queued and goes with the next submission or wait
+    void submit_() {
+      while(io_uring_submit(&ring_) == -EINTR) {
+      }
+    }
+
+    // Moves slot on once none of its requests are in flight: the slot's
+    // path, statx buffer and data may only change (or be reused for the
+    // next file) when the kernel no longer references them
+    void advance_(Slot& slot) {
+      if(slot.pending || slot.done) {
+        return;
+      }
+      if(slot.failed || slot.fd < 0) {
+        finishRead_(slot, false);
+      } else if(slot.filled >= slot.data.size()) {
+        finishRead_(slot, true);
+      } else if(!prepare_(slot, Read)) {
+        finishRead_(slot, false);
+      } else {
+        submit_();
+      }
+    }
+
+    void finishRead_(Slot& slot, bool ok) {
+      if(slot.fd >= 0) {
+        close(slot.fd);
+        slot.fd = -1;
+      }
+      slot.ok = ok;
+      slot.done = true;
+    }
+#endif
+
+    // Reads a whole file into data, returns false on failure
+    static bool readFile_(const std::string& path, std::vector<uint8_t>& data) {
+      const int fd = open(path.c_str(), O_RDONLY);
+      if(fd < 0) {
+        return false;
+      }
+      struct stat status;
+      bool ok = fstat(fd, &status) == 0;
+      if(ok) {
+        data.resize(status.st_size);
+        size_t filled = 0;
+        while(ok && filled < data.size()) {
+          const ssize_t result = pread(fd, data.data() + filled, data.size() - filled, filled);
+          ok = result > 0;
+          filled += ok ? result : 0;
+        }
+      }
+      close(fd);
+      return ok;
+    }
+
+    void run_() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while(true) {
+        readAvailable_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if(stopping_) {
+          return;
+        }
+        const size_t index = queue_.front();
+        queue_.pop_front();
+        Slot& slot = slot_(index);
+        const std::string path = slot.path;
+        lock.unlock();
+
+        // the slot is not touched by the decode loop until it is done
+        const bool ok = readFile_(path, slot.data);
+
+        lock.lock();
+        slot.ok = ok;
+        slot.done = true;
+        readDone_.notify_all();
+      }
+    }
+
+    J2KDecoder decoder_;
+    std::vector<Slot> slots_;
+    bool useIoUring_;
+#ifdef OPENJPEGJS_USE_IO_URING
+    io_uring ring_;
+#endif
+    std::mutex mutex_;
+    std::condition_variable readAvailable_;
+    std::condition_variable readDone_;
+    std::vector<std::thread> readers_;
+    std::deque<size_t> queue_;
+    bool stopping_;
+    double ioWaitMS_;
+    double decodeMS_;
+    uint64_t bytesRead_;
+};
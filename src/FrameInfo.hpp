@@ -7,14 +7,14 @@
 
 struct FrameInfo {
     /// <summary>
-    /// Width of the image, range [1, 65535].
+    /// Width of the image, range [1, 4294967295].
     /// </summary>
-    uint16_t width;
+    uint32_t width;
 
     /// <summary>
-    /// Height of the image, range [1, 65535].
+    /// Height of the image, range [1, 4294967295].
     /// </summary>
-    uint16_t height;
+    uint32_t height;
 
     /// <summary>
     /// Number of bits per sample, range [2, 16]
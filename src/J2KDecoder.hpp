@@ -3,8 +3,12 @@
 
 #pragma once
 
+#include <chrono>
 #include <exception>
+#include <functional>
+#include <map>
 #include <memory>
+#include <tuple>
 #include <limits.h>
 
 #include "openjpeg.h"
@@ -12,30 +16,82 @@
 #include <stdlib.h>
 #define EMSCRIPTEN_API __attribute__((used))
 #define J2K_MAGIC_NUMBER 0x51FF4FFF
+// COM marker text recording the bitsPerSample of auto bit depth encodes
+#define J2K_BITS_PER_SAMPLE_COMMENT "openjpegjs bitsPerSample="
+// COM marker text recording the number of slices of volume encodes
+#define J2K_VOLUME_COMMENT "openjpegjs volume="
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten/val.h>
 #endif
 
 #include "BufferStream.hpp"
+#include "CancellationToken.hpp"
 
+#include "DecodeLimits.hpp"
+#include "DecodeOptions.hpp"
+#include "DecodeResult.hpp"
+#include "Diagnostics.hpp"
+#include "Estimate.hpp"
 #include "FrameInfo.hpp"
+#include "J2KStatus.hpp"
 #include "Point.hpp"
 #include "Size.hpp"
+#include "Statistics.hpp"
 
 /// <summary>
-/// JavaScript API for decoding HTJ2K bistreams with OpenJPH
+/// JavaScript API for decoding JPEG 2000 bitstreams (J2K/JP2, including
+/// High-Throughput JPEG 2000 / Part 15 codestreams) with openjp2
 /// </summary>
 class J2KDecoder {
   public: 
+#ifdef __EMSCRIPTEN__
+  typedef emscripten::val BandCallback;
+#else
+  typedef std::function<bool(size_t firstRow, size_t numRows)> BandCallback;
+#endif
+
   /// <summary>
-  /// Constructor for decoding a HTJ2K image from JavaScript.
+  /// Constructor for decoding a J2K image from JavaScript.
   /// </summary>
   J2KDecoder() :
-  decodeLayer_(1)
+  encodedData_(NULL),
+  encodedSize_(0),
+  numThreads_(0),
+  status_(J2KStatus::Ok),
+  timeLimit_(0),
+  limits_(),
+  frameInfo_(),
+  headerRead_(false),
+  numDecompositions_(0),
+  isReversible_(false),
+  isHighThroughput_(false),
+  progressionOrder_(0),
+  numLayers_(0),
+  colorSpace_(0),
+  numSlices_(0),
+  decodeLayer_(1),
+  decodeSlice_(SIZE_MAX),
+  statisticsEnabled_(false),
+  histogramBins_(0),
+  convertToRGB_(false),
+  sessionCodec_(NULL),
+  sessionStream_(NULL),
+  sessionImage_(NULL),
+  sessionReusable_(false),
+  sessionDecoded_(false)
   {
   }
 
+  ~J2KDecoder() {
+    endProgressiveDecode();
+  }
+
+  // the progressive decode session owns openjp2 handles, a copy would
+  // destroy them twice
+  J2KDecoder(const J2KDecoder&) = delete;
+  J2KDecoder& operator=(const J2KDecoder&) = delete;
+
 #ifdef __EMSCRIPTEN__
   /// <summary>
   /// Resizes encoded buffer and returns a TypedArray of the buffer allocated
@@ -45,6 +101,8 @@ class J2KDecoder {
   /// in a sandbox and cannot access memory managed by JavaScript.
   /// </summary>
   emscripten::val getEncodedBuffer(size_t encodedSize) {
+    endProgressiveDecode();
+    headerRead_ = false;
     encoded_.resize(encodedSize);
     return emscripten::val(emscripten::typed_memory_view(encoded_.size(), encoded_.data()));
   }
@@ -56,15 +114,66 @@ class J2KDecoder {
   emscripten::val getDecodedBuffer() {
     return emscripten::val(emscripten::typed_memory_view(decoded_.size(), decoded_.data()));
   }
+
+  /// <summary>
+  /// Returns a TypedArray of the buffer allocated in WASM memory space that
+  /// holds the decoded pixel data for a decomposition level after
+  /// decodePyramid()
+  /// </summary>
+  emscripten::val getPyramidBuffer(size_t decompositionLevel) {
+    const std::vector<uint8_t>& level = getPyramidBytes(decompositionLevel);
+    return emscripten::val(emscripten::typed_memory_view(level.size(), level.data()));
+  }
+
+  /// <summary>
+  /// Returns a Uint32Array of the histogram computed for a component by the
+  /// last decode, see setStatistics()
+  /// </summary>
+  emscripten::val getHistogramBuffer(size_t component) {
+    const std::vector<uint32_t>& histogram = getHistogram(component);
+    return emscripten::val(emscripten::typed_memory_view(histogram.size(), histogram.data()));
+  }
+
+  /// <summary>
+  /// Copies the encoded bitstream from a TypedArray, decodes it with options
+  /// and returns the metadata and a TypedArray of the decoded pixel data in
+  /// one call, instead of getEncodedBuffer(), decode(), getFrameInfo(),
+  /// getDecodedBuffer() and the other getters each crossing into WASM.
+  /// </summary>
+  DecodeResult decodeFrame(emscripten::val encoded, const DecodeOptions& options) {
+    getEncodedBuffer(encoded["length"].as<size_t>()).call<void>("set", encoded);
+    decodeSubResolution(options.decompositionLevel, options.decodeLayer);
+    DecodeResult result = getDecodeResult();
+    result.pixelData = getDecodedBuffer();
+    return result;
+  }
 #else
   /// <summary>
   /// Returns the buffer to store the encoded bytes.  This method is not exported
   /// to JavaScript, it is intended to be called by C++ code
   /// </summary>
   std::vector<uint8_t>& getEncodedBytes() {
+      endProgressiveDecode();
+      headerRead_ = false;
+      encodedData_ = NULL;
+      encodedSize_ = 0;
       return encoded_;
   }
 
+  /// <summary>
+  /// Decodes from caller owned memory instead of the internal encoded buffer
+  /// so the bitstream does not need to be copied.  The memory must remain
+  /// valid until the next call to setEncodedBytes() or getEncodedBytes().
+  /// This method is not exported to JavaScript, it is intended to be called
+  /// by C++ code
+  /// </summary>
+  void setEncodedBytes(const uint8_t* data, size_t size) {
+      endProgressiveDecode();
+      headerRead_ = false;
+      encodedData_ = data;
+      encodedSize_ = size;
+  }
+
   /// <summary>
   /// Returns the buffer to store the decoded bytes.  This method is not exported
   /// to JavaScript, it is intended to be called by C++ code
@@ -73,6 +182,15 @@ class J2KDecoder {
       return decoded_;
   }
 #endif
+
+  /// <summary>
+  /// Returns the decoded bytes for a decomposition level after
+  /// decodePyramid(), empty if the level was not decoded
+  /// </summary>
+  const std::vector<uint8_t>& getPyramidBytes(size_t decompositionLevel) const {
+      static const std::vector<uint8_t> empty;
+      return decompositionLevel < pyramid_.size() ? pyramid_[decompositionLevel] : empty;
+  }
  
   /// <summary>
   /// Reads the header from an encoded HTJ2K bitstream.  The caller must have
@@ -80,11 +198,77 @@ class J2KDecoder {
   /// calling this method, see getEncodedBuffer() and getEncodedBytes() above.
   /// </summary>
   void readHeader() {
-    /*ojph::codestream codestream;
-    ojph::mem_infile mem_file;
-    mem_file.open(encoded_.data(), encoded_.size());
-    readHeader_(codestream, mem_file);
-    */
+    CancellationToken::Scope operation(cancellation_);
+    opj_codec_t* l_codec = NULL;
+    opj_image_t* image = NULL;
+    opj_stream_t *l_stream = NULL;
+    opj_buffer_info_t buffer_info;
+
+    if(!readHeader_(l_codec, l_stream, image, buffer_info, 0)) {
+        return;
+    }
+    readInfo_(l_codec, image);
+
+    opj_stream_destroy(l_stream);
+    opj_destroy_codec(l_codec);
+    opj_image_destroy(image);
+  }
+
+  /// <summary>
+  /// Estimates the memory and relative cost of decoding to the requested
+  /// decomposition level without decoding, so jobs can be admitted against
+  /// a memory budget.  region limits the estimate to an area of the full
+  /// resolution image (0x0 = whole image) and numComponents to the first
+  /// components (0 = all).  The header is read if neither readHeader() nor
+  /// a decode has been called since the encoded bytes were last set; all
+  /// sizes are 0 if it can't be read.
+  /// </summary>
+  Estimate estimateDecode(size_t decompositionLevel, Size region, size_t numComponents) {
+    if(!headerRead_) {
+      readHeader();
+      if(!headerRead_) {
+        return Estimate();
+      }
+    }
+    const Size size = calculateSizeAtDecompositionLevel(decompositionLevel);
+    uint64_t width = size.width;
+    uint64_t height = size.height;
+    double fraction = 1.0 / ((uint64_t)1 << (2 * std::min<size_t>(decompositionLevel, 31)));
+    if(region.width && region.height && frameInfo_.width && frameInfo_.height) {
+      width = std::min<uint64_t>(width, ceilDivPow2_(region.width, decompositionLevel));
+      height = std::min<uint64_t>(height, ceilDivPow2_(region.height, decompositionLevel));
+      fraction *= std::min(1.0, ((double)region.width * region.height) / ((double)frameInfo_.width * frameInfo_.height));
+    }
+    const uint64_t components = numComponents ? std::min<size_t>(numComponents, frameInfo_.componentCount) : frameInfo_.componentCount;
+    const uint64_t samples = width * height * components;
+    const uint64_t bytesPerPixel = (frameInfo_.bitsPerSample + 8 - 1) / 8;
+
+    // tile grid
+    const uint64_t tileWidth = std::max<uint64_t>(1, tileSize_.width);
+    const uint64_t tileHeight = std::max<uint64_t>(1, tileSize_.height);
+    const uint64_t numTiles = ceilDiv_(frameInfo_.width - tileOffset_.x, tileWidth) * ceilDiv_(frameInfo_.height - tileOffset_.y, tileHeight);
+    const uint64_t threads = std::max<uint64_t>(1, numThreads_);
+    const uint64_t reducedTileWidth = ceilDivPow2_(std::min<uint64_t>(tileWidth, frameInfo_.width), decompositionLevel);
+    const uint64_t reducedTileHeight = ceilDivPow2_(std::min<uint64_t>(tileHeight, frameInfo_.height), decompositionLevel);
+
+    // openjp2 copies the compressed data of the tile being decoded, single
+    // tile images decode straight into the image planes while tiled images
+    // decode into a tile buffer first.  Every thread needs a code-block
+    // buffer and wavelet line buffers (8 interleaved columns of 4 bytes).
+    uint64_t workspace = threads * ((uint64_t)blockDimensions_.width * blockDimensions_.height * 4 +
+                                    std::max(reducedTileWidth, reducedTileHeight) * 8 * 4);
+    if(numTiles > 1) {
+      workspace += reducedTileWidth * reducedTileHeight * components * 4;
+    }
+
+    Estimate estimate;
+    estimate.encodedBytes = saturate_(encodedSize() + ceilDiv_(encodedSize(), std::max<uint64_t>(1, numTiles)));
+    estimate.imageBytes = saturate_(samples * 4);
+    estimate.workspaceBytes = saturate_(workspace);
+    estimate.decodedBytes = saturate_(samples * bytesPerPixel);
+    estimate.totalBytes = saturate_((uint64_t)estimate.encodedBytes + estimate.imageBytes + estimate.workspaceBytes + estimate.decodedBytes);
+    estimate.cost = samples + 8.0 * encodedSize() * fraction * components / std::max<size_t>(1, frameInfo_.componentCount);
+    return estimate;
   }
 
   /// <summary>
@@ -102,38 +286,245 @@ class J2KDecoder {
     return result;
   }
 
-  static void error_callback(const char *msg, void *client_data) {
-      (void)client_data;
-      printf("[ERROR] %s", msg);
-  }
-  static void warning_callback(const char *msg, void *client_data) {
-      (void)client_data;
-      printf("[WARNING] %s", msg);
-  }
-  static void info_callback(const char *msg, void *client_data) {
-      (void)client_data;
-      printf("[INFO] %s", msg);
-  }
-
   /// <summary>
   /// Decodes the encoded HTJ2K bitstream.  The caller must have copied the
   /// HTJ2K encoded bitstream into the encoded buffer before calling this
-  /// method, see getEncodedBuffer() and getEncodedBytes() above.
+  /// method, see getEncodedBuffer() and getEncodedBytes() above.  Returns
+  /// getStatus(), see getDiagnostic() for the reason of a failure.
   /// </summary>
-  void decode() {
+  J2KStatus decode() {
+    CancellationToken::Scope operation(cancellation_);
     decodeLayer_ = 0;
     decode_i(0);
+    return status_;
   }
 
   /// <summary>
   /// Decodes the encoded HTJ2K bitstream to the requested decomposition level.
   /// The caller must have copied the HTJ2K encoded bitstream into the encoded 
   /// buffer before calling this method, see getEncodedBuffer() and
-  ///  getEncodedBytes() above.
+  ///  getEncodedBytes() above.  Returns getStatus().
   /// </summary>
-  void decodeSubResolution(size_t decompositionLevel, size_t decodeLayer) {
+  J2KStatus decodeSubResolution(size_t decompositionLevel, size_t decodeLayer) {
+    CancellationToken::Scope operation(cancellation_);
     decodeLayer_ = decodeLayer;
     decode_i(decompositionLevel);
+    return status_;
+  }
+
+  /// <summary>
+  /// Decodes to the requested decomposition level with as many quality
+  /// layers as are estimated to decode within milliseconds, so a viewer can
+  /// show a lower quality frame on time and refine it later (see
+  /// getLayersDecoded()).  The estimates are learned from the decode times
+  /// of previous frames with the same size, components, bits per sample,
+  /// layers, decomposition level and threads; the first frame decodes all
+  /// layers.  Returns getStatus().
+  /// </summary>
+  J2KStatus decodeWithinBudget(double milliseconds, size_t decompositionLevel) {
+    CancellationToken::Scope operation(cancellation_);
+    LayerCostKey key;
+    const size_t numLayers = scanLayerCostKey_(decompositionLevel, key);
+    if(numLayers == 0) {
+      return decodeSubResolution(decompositionLevel, 0);
+    }
+    if(layerCosts_.size() >= 16 && !layerCosts_.count(key)) {
+      layerCosts_.clear();
+    }
+    std::vector<double>& costs = layerCosts_[key];
+    costs.resize(numLayers + 1, 0);
+
+    const size_t layers = chooseLayers_(costs, milliseconds);
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    decodeSubResolution(decompositionLevel, layers == numLayers ? 0 : layers);
+    if(status_ == J2KStatus::Ok) {
+      const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      costs[layers] = costs[layers] > 0 ? costs[layers] * 0.75 + elapsed * 0.25 : elapsed;
+    }
+    return status_;
+  }
+
+  /// <summary>
+  /// Decodes one slice of a volume encoded with J2KEncoder::encodeVolume()
+  /// to the requested decomposition level.  Only the components of the
+  /// slice pair are decoded.  The decoded buffer holds the slice and
+  /// getFrameInfo().componentCount is 1.  At decomposition level 0 of a
+  /// lossless volume the slice is exact.  At higher levels the inverse
+  /// slice transform is applied to the reduced resolution mean and
+  /// difference, and the rounding of the mean does not commute with the
+  /// wavelet low pass, so the slice can differ by a few values from
+  /// decoding the separately encoded slice at that level.  Returns
+  /// getStatus().
+  /// </summary>
+  J2KStatus decodeSlice(size_t slice, size_t decompositionLevel) {
+    CancellationToken::Scope operation(cancellation_);
+    decodeLayer_ = 0;
+    decodeSlice_ = slice;
+    decode_i(decompositionLevel);
+    decodeSlice_ = SIZE_MAX;
+    return status_;
+  }
+
+  /// <summary>
+  /// Decodes the encoded HTJ2K bitstream to the requested decomposition level
+  /// one tile at a time.  callback(firstRow, numRows) is called each time a
+  /// row of tiles has been decoded and converted into the decoded buffer, so
+  /// the top of a large image can be displayed while the rest is still
+  /// decoding.  The decoded buffer is allocated before the first callback
+  /// and must not be resized from the callback.  Untiled images produce a
+  /// single band.  Images with down sampled components, or YCbCr images
+  /// when setConvertToRGB() is enabled, are not supported (getStatus() ==
+  /// Failed), decode them with decode().  The callback returns false to
+  /// stop the decode, which
+  /// then ends with getStatus() == Cancelled; any other return value (e.g.
+  /// undefined from JavaScript) continues.  The WASM build has exceptions
+  /// disabled, a JavaScript callback must not throw.
+  /// </summary>
+  void decodeBands(size_t decompositionLevel, size_t decodeLayer, BandCallback callback) {
+    CancellationToken::Scope operation(cancellation_);
+    decodeLayer_ = decodeLayer;
+    decodeBands_(decompositionLevel, callback);
+  }
+
+  /// <summary>
+  /// Starts a progressive decode session, e.g. a preview at a high
+  /// decomposition level followed by full resolution.  The main header is
+  /// read once and the codec is kept open until endProgressiveDecode() (or
+  /// the encoded buffer changes) so each decodeProgressive() call only has
+  /// to decode, not re-read and re-parse the bitstream.
+  /// </summary>
+  void beginProgressiveDecode(size_t decodeLayer) {
+    CancellationToken::Scope operation(cancellation_);
+    endProgressiveDecode();
+    decodeLayer_ = decodeLayer;
+    beginSession_();
+  }
+
+  /// <summary>
+  /// Decodes the session to the requested decomposition level into the
+  /// decoded buffer, typically called with decreasing levels.  Single tile
+  /// images reuse the packet data openjp2 read for the previous level, tiled
+  /// images are re-read from the bitstream.
+  /// </summary>
+  void decodeProgressive(size_t decompositionLevel) {
+    CancellationToken::Scope operation(cancellation_);
+    if(!sessionCodec_ || (sessionDecoded_ && !sessionReusable_)) {
+      endProgressiveDecode();
+      if(!beginSession_()) {
+        return;
+      }
+    }
+    status_ = J2KStatus::Ok;
+    cancellation_.start();
+
+    if(!opj_set_decoded_resolution_factor(sessionCodec_, decompositionLevel) ||
+       !opj_set_decode_area(sessionCodec_, sessionImage_, imageOffset_.x, imageOffset_.y, frameInfo_.width, frameInfo_.height) ||
+       !opj_decode(sessionCodec_, sessionStream_, sessionImage_) ||
+       cancellation_.isCancelled()) {
+      diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::DecodeFailed, "opj_decompress: failed to decode tile!");
+      status_ = failureStatus_();
+      if(isStopped_()) {
+        std::vector<uint8_t>().swap(decoded_);
+      }
+      endProgressiveDecode();
+      return;
+    }
+    sessionDecoded_ = true;
+    convertImage_(sessionImage_, decompositionLevel);
+  }
+
+  /// <summary>
+  /// Decodes every decomposition level, from the lowest resolution up to
+  /// full resolution, in one progressive decode session (see
+  /// decodeProgressive()).  Each level is converted to native samples and
+  /// can be retrieved with getPyramidBuffer()/getPyramidBytes() and
+  /// described with getPyramidFrameInfo().  The decoded buffer is not
+  /// valid after this call.
+  /// </summary>
+  void decodePyramid(size_t decodeLayer) {
+    CancellationToken::Scope operation(cancellation_);
+    beginProgressiveDecode(decodeLayer);
+    if(status_ != J2KStatus::Ok) {
+      pyramid_.clear();
+      return;
+    }
+    pyramid_.resize(numDecompositions_ + 1);
+    for(size_t level = numDecompositions_ + 1; level-- > 0;) {
+      decodeProgressive(level);
+      if(status_ != J2KStatus::Ok) {
+        pyramid_.clear();
+        break;
+      }
+      // the previous contents of the level become the next scratch buffer
+      pyramid_[level].swap(decoded_);
+    }
+    endProgressiveDecode();
+  }
+
+  /// <summary>
+  /// returns the FrameInfo object for a decomposition level after
+  /// decodePyramid()
+  /// </summary>
+  FrameInfo getPyramidFrameInfo(size_t decompositionLevel) {
+    FrameInfo frameInfo = frameInfo_;
+    Size size = calculateSizeAtDecompositionLevel(decompositionLevel);
+    frameInfo.width = size.width;
+    frameInfo.height = size.height;
+    return frameInfo;
+  }
+
+  /// <summary>
+  /// Ends the progressive decode session and releases the codec
+  /// </summary>
+  void endProgressiveDecode() {
+    if(sessionCodec_) {
+      opj_stream_destroy(sessionStream_);
+      opj_destroy_codec(sessionCodec_);
+      opj_image_destroy(sessionImage_);
+    }
+    sessionCodec_ = NULL;
+    sessionStream_ = NULL;
+    sessionImage_ = NULL;
+    sessionDecoded_ = false;
+  }
+
+  /// <summary>
+  /// Decodes the encoded bitstream to the requested decomposition level and
+  /// returns the openjp2 image without converting it to native samples.
+  /// The caller owns the returned image and must release it with
+  /// opj_image_destroy().  Returns NULL if decoding fails.  This method is
+  /// not exported to JavaScript, it is intended to be called by C++ code
+  /// (see J2KTranscoder)
+  /// </summary>
+  opj_image_t* decodeToImage(size_t decompositionLevel, size_t decodeLayer) {
+    CancellationToken::Scope operation(cancellation_);
+    decodeLayer_ = decodeLayer;
+    return decodeImage_(decompositionLevel);
+  }
+
+  /// <summary>
+  /// Returns the number of tiles of a bitstream from its SIZ marker without
+  /// decoding it, 0 if there is no SIZ marker.  This method is not exported
+  /// to JavaScript, it is intended to be called by C++ code (see
+  /// DecodeScheduler)
+  /// </summary>
+  static size_t countTiles(const uint8_t* data, size_t size) {
+    size_t numTiles = 0;
+    visitMainHeader_(data, size, [&](uint16_t marker, const uint8_t* segment, size_t length) {
+      // SIZ: Rsiz, Xsiz, Ysiz, XOsiz, YOsiz, XTsiz, YTsiz, XTOsiz, YTOsiz
+      if(marker == 0xFF51 && length >= 38) {
+        const uint32_t width = readUint32BE_(segment + 2);
+        const uint32_t height = readUint32BE_(segment + 6);
+        const uint32_t tileWidth = std::max<uint32_t>(1, readUint32BE_(segment + 18));
+        const uint32_t tileHeight = std::max<uint32_t>(1, readUint32BE_(segment + 22));
+        const uint32_t tileOffsetX = std::min(width, readUint32BE_(segment + 26));
+        const uint32_t tileOffsetY = std::min(height, readUint32BE_(segment + 30));
+        numTiles = ceilDiv_(width - tileOffsetX, tileWidth) * ceilDiv_(height - tileOffsetY, tileHeight);
+        return true;
+      }
+      return false;
+    });
+    return numTiles;
   }
 
   /// <summary>
@@ -157,6 +548,16 @@ class J2KDecoder {
       return isReversible_;
   }
 
+  /// <summary>
+  /// returns true if the codestream uses the High-Throughput (HTJ2K, Part
+  /// 15) block coder, detected from the CAP and COD markers of the main
+  /// header.  openjp2 2.5 and later decode HT code-blocks with its HT block
+  /// decoder, older versions fail the decode with an error.
+  /// </summary>
+  bool getIsHighThroughput() const {
+      return isHighThroughput_;
+  }
+
   /// <summary>
   /// returns progression order.
   // -1 = unknown??
@@ -205,6 +606,16 @@ class J2KDecoder {
     return numLayers_;
   }
 
+  /// <summary>
+  /// returns the number of quality layers used by the last decode, less
+  /// than getNumLayers() when decodeWithinBudget() or the decodeLayer of
+  /// decodeSubResolution() limited them
+  /// </summary>
+  size_t getLayersDecoded() const {
+    const size_t numLayers = numLayers_ > 0 ? numLayers_ : 0;
+    return decodeLayer_ == 0 ? numLayers : std::min(decodeLayer_, numLayers);
+  }
+
   //  OPJ_CLRSPC_UNKNOWN = -1,    /**< not supported by the library */
   //  OPJ_CLRSPC_UNSPECIFIED = 0, /**< not specified in the codestream */
   //  OPJ_CLRSPC_SRGB = 1,        /**< sRGB */
@@ -216,27 +627,562 @@ class J2KDecoder {
     return colorSpace_;
   }
 
+  /// <summary>
+  /// returns the number of slices of a volume encoded with
+  /// J2KEncoder::encodeVolume(), 0 for other bitstreams.  decode() stores
+  /// the slices one after the other and getFrameInfo().componentCount is
+  /// the number of slices.
+  /// </summary>
+  size_t getNumSlices() const {
+    return numSlices_;
+  }
+
+  /// <summary>
+  /// returns the status and all the header information above for the last
+  /// decode (or readHeader())
+  /// </summary>
+  DecodeResult getDecodeResult() const {
+    DecodeResult result;
+    result.status = status_;
+    result.frameInfo = frameInfo_;
+    result.numDecompositions = numDecompositions_;
+    result.isReversible = isReversible_;
+    result.isHighThroughput = isHighThroughput_;
+    result.progressionOrder = progressionOrder_;
+    result.imageOffset = imageOffset_;
+    result.tileSize = tileSize_;
+    result.tileOffset = tileOffset_;
+    result.blockDimensions = blockDimensions_;
+    result.numLayers = numLayers_;
+    result.colorSpace = colorSpace_;
+    return result;
+  }
+
+  /// <summary>
+  /// Sets the number of threads openjp2 may use to decode, 0 = single
+  /// threaded.  Only has an effect when openjp2 is built with
+  /// OPJ_USE_THREAD (e.g. the native Node.js addon)
+  /// </summary>
+  void setNumThreads(size_t numThreads) {
+    numThreads_ = numThreads;
+  }
+
+  /// <summary>
+  /// Requests that a decode running on another thread, or the next decode
+  /// if none is running, stops as soon as possible.  The decode returns with
+  /// getStatus() == Cancelled and the decoded buffer released.  Cancellation
+  /// is checked whenever openjp2 reads from the bitstream (before each tile
+  /// of a tiled image) and between the decode phases, the T1/DWT decode of
+  /// a single tile is not interrupted.
+  /// </summary>
+  void cancel() {
+    cancellation_.cancel();
+  }
+
+  /// <summary>
+  /// returns the number of the running decode, or the next one if none is
+  /// running, for cancelOperation().  This method is not exported to
+  /// JavaScript, it is intended to be called by C++ code (see
+  /// DecodeScheduler)
+  /// </summary>
+  uint64_t getOperation() const {
+    return cancellation_.getOperation();
+  }
+
+  /// <summary>
+  /// Like cancel() but only stops the decode numbered operation (see
+  /// getOperation()), does nothing if that decode already finished.  This
+  /// method is not exported to JavaScript.
+  /// </summary>
+  void cancelOperation(uint64_t operation) {
+    cancellation_.cancel(operation);
+  }
+
+  /// <summary>
+  /// Sets the maximum time in milliseconds a decode may take before it is
+  /// cancelled, 0 = no limit (default)
+  /// </summary>
+  void setTimeLimit(double milliseconds) {
+    timeLimit_ = milliseconds;
+    applyTimeLimit_();
+  }
+
+  /// <summary>
+  /// Sets resource limits for untrusted bitstreams.  The size, component,
+  /// tile, code-block and memory limits are checked against the SIZ and COD
+  /// markers before openjp2 reads the header or allocates anything, the
+  /// time limit while decoding (before each tile, see
+  /// DecodeLimits::maxDecodeTime).  A decode over a limit fails with
+  /// getStatus() == LimitExceeded and the decoded buffer released.  No
+  /// limits by default.
+  /// </summary>
+  void setLimits(const DecodeLimits& limits) {
+    limits_ = limits;
+    applyTimeLimit_();
+  }
+
+  /// <summary>
+  /// returns the limits set with setLimits()
+  /// </summary>
+  DecodeLimits getLimits() const {
+    return limits_;
+  }
+
+  /// <summary>
+  /// returns the status of the last decode
+  /// </summary>
+  J2KStatus getStatus() const {
+    return status_;
+  }
+
+  /// <summary>
+  /// Sets which openjp2 and decoder messages are also printed to stdout:
+  /// 0 = none (default), 1 = errors, 2 = errors and warnings, 3 = all
+  /// </summary>
+  void setVerbosity(size_t verbosity) {
+    diagnostics_.setVerbosity(verbosity);
+  }
+
+  /// <summary>
+  /// returns the number of messages kept from the last decode, the most
+  /// recent 16
+  /// </summary>
+  size_t getNumDiagnostics() const {
+    return diagnostics_.size();
+  }
+
+  /// <summary>
+  /// returns a message kept from the last decode, 0 is the oldest
+  /// </summary>
+  Diagnostic getDiagnostic(size_t index) const {
+    if(index < diagnostics_.size()) {
+      return diagnostics_.get(index);
+    }
+    return Diagnostic();
+  }
+
+  /// <summary>
+  /// returns the number of errors reported by the last decode
+  /// </summary>
+  size_t getNumErrors() const {
+    return diagnostics_.getCount(DiagnosticLevel::Error);
+  }
+
+  /// <summary>
+  /// returns the number of warnings reported by the last decode
+  /// </summary>
+  size_t getNumWarnings() const {
+    return diagnostics_.getCount(DiagnosticLevel::Warning);
+  }
+
+  /// <summary>
+  /// Enables per component min/max and, if numBins > 0, a histogram with
+  /// numBins bins over the range of bitsPerSample.  They are accumulated
+  /// while decoded samples are converted to the native sample type so
+  /// window/level can be computed without another pass over the decoded
+  /// buffer.  Disabled by default.
+  /// </summary>
+  void setStatistics(bool enabled, size_t numBins) {
+    statisticsEnabled_ = enabled;
+    histogramBins_ = numBins;
+  }
+
+  /// <summary>
+  /// returns the statistics of a component computed by the last decode
+  /// </summary>
+  Statistics getStatistics(size_t component) const {
+    if(component < statistics_.size()) {
+      return statistics_[component];
+    }
+    Statistics empty = {0, 0, 0, 0};
+    return empty;
+  }
+
+  /// <summary>
+  /// returns the histogram of a component computed by the last decode
+  /// </summary>
+  const std::vector<uint32_t>& getHistogram(size_t component) const {
+    static const std::vector<uint32_t> empty;
+    return component < histograms_.size() ? histograms_[component] : empty;
+  }
+
+  /// <summary>
+  /// When enabled, three component images coded as YCbCr without the
+  /// multiple component transform (color space SYCC or down sampled chroma)
+  /// are converted to RGB while the components are interleaved into the
+  /// decoded buffer.  Down sampled (4:2:2, 4:2:0) components are always
+  /// upsampled to the full resolution by decode(), decodeSubResolution(),
+  /// decodeProgressive() and decodePyramid().  Disabled by default.
+  /// </summary>
+  void setConvertToRGB(bool convertToRGB) {
+    convertToRGB_ = convertToRGB;
+  }
+
   private:
 
-    void decode_i(size_t decompositionLevel) {
+    const uint8_t* encodedData() const {
+      return encodedData_ ? encodedData_ : encoded_.data();
+    }
+
+    size_t encodedSize() const {
+      return encodedData_ ? encodedSize_ : encoded_.size();
+    }
+
+    J2KStatus failureStatus_() const {
+      return cancellation_.isCancelled() ? cancelledStatus_() : J2KStatus::Failed;
+    }
+
+    // LimitExceeded if the decode ran into DecodeLimits::maxDecodeTime
+    // rather than cancel() or setTimeLimit()
+    J2KStatus cancelledStatus_() const {
+      if(limits_.maxDecodeTime > 0 && !cancellation_.isCancelRequested() &&
+         cancellation_.elapsed() >= limits_.maxDecodeTime) {
+        return J2KStatus::LimitExceeded;
+      }
+      return J2KStatus::Cancelled;
+    }
+
+    // the decoded buffer is released when a decode is stopped
+    bool isStopped_() const {
+      return status_ == J2KStatus::Cancelled || status_ == J2KStatus::LimitExceeded;
+    }
+
+    void applyTimeLimit_() {
+      double limit = timeLimit_;
+      if(limits_.maxDecodeTime > 0 && (limit <= 0 || limits_.maxDecodeTime < limit)) {
+        limit = limits_.maxDecodeTime;
+      }
+      cancellation_.setTimeLimit(limit);
+    }
+
+    static uint16_t readUint16BE_(const uint8_t* p) {
+      return (p[0] << 8) | p[1];
+    }
+
+    static uint32_t readUint32BE_(const uint8_t* p) {
+      return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    // Returns the offset of the SOC marker, JP2 files are searched for the
+    // contiguous codestream box.  Returns size if there is no codestream.
+    static size_t findCodestream_(const uint8_t* data, size_t size) {
+      size_t position = 0;
+      if(size >= 12 && memcmp(data + 4, "jP  ", 4) == 0) {
+        while(position + 8 <= size) {
+          uint64_t length = readUint32BE_(data + position);
+          size_t header = 8;
+          if(length == 1 && position + 16 <= size) {
+            length = ((uint64_t)readUint32BE_(data + position + 8) << 32) | readUint32BE_(data + position + 12);
+            header = 16;
+          }
+          if(memcmp(data + position + 4, "jp2c", 4) == 0) {
+            position += header;
+            break;
+          }
+          if(length < header || length > size - position) {
+            return size;
+          }
+          position += length;
+        }
+      }
+      if(position + 4 > size || readUint16BE_(data + position) != 0xFF4F) {
+        return size;
+      }
+      return position;
+    }
+
+    // Checks the SIZ marker against limits_ before openjp2 allocates the
+    // tile parameters (one per tile) in opj_read_header() and the image
+    // planes in opj_decode().  Bitstreams without a readable SIZ marker are
+    // left to openjp2 to reject.
+    // Code-blocks a decode to decompositionLevel has to entropy decode, from
+    // the SIZ component sizes and the COD decompositions and code-block
+    // size: three bands for each decoded decomposition plus the lowest
+    // resolution per component, and a partial block per band and tile at
+    // the tile edges.  COC/precinct overrides are ignored.
+    double countCodeBlocks_(uint64_t x0, uint64_t y0, uint64_t x1, uint64_t y1, uint64_t tiles,
+                            const uint8_t* components, size_t numComponents, size_t decompositionLevel) const {
+      size_t numDecompositions = 5;
+      size_t blockWidthExponent = 6, blockHeightExponent = 6;
+      visitMainHeader_(encodedData(), encodedSize(), [&](uint16_t marker, const uint8_t* segment, size_t length) {
+        // COD: Scod, progression order, layers, MCT, decompositions, xcb, ycb
+        if(marker == 0xFF52 && length >= 10) {
+          numDecompositions = segment[5];
+          blockWidthExponent = std::min(segment[6] + 2, 10);
+          blockHeightExponent = std::min(segment[7] + 2, 10);
+          return true;
+        }
+        return false;
+      });
+      const size_t lowest = std::min(decompositionLevel, numDecompositions);
+      double codeBlocks = 0;
+      for(size_t c = 0; c < numComponents; c++) {
+        const uint64_t dx = std::max<uint8_t>(1, components[c * 3 + 1]);
+        const uint64_t dy = std::max<uint8_t>(1, components[c * 3 + 2]);
+        const uint64_t width = ceilDivU64_(x1, dx) - ceilDivU64_(x0, dx);
+        const uint64_t height = ceilDivU64_(y1, dy) - ceilDivU64_(y0, dy);
+        for(size_t d = numDecompositions; d > lowest; d--) {
+          codeBlocks += 3.0 * ceilDivPow2U64_(ceilDivPow2U64_(width, d), blockWidthExponent) *
+                              ceilDivPow2U64_(ceilDivPow2U64_(height, d), blockHeightExponent);
+        }
+        codeBlocks += (double)ceilDivPow2U64_(ceilDivPow2U64_(width, numDecompositions), blockWidthExponent) *
+                              ceilDivPow2U64_(ceilDivPow2U64_(height, numDecompositions), blockHeightExponent);
+        if(tiles > 1) {
+          codeBlocks += (double)tiles * (3 * (numDecompositions - lowest) + 1);
+        }
+      }
+      return codeBlocks;
+    }
+
+    bool checkLimits_(size_t decompositionLevel) {
+      const uint8_t* data = encodedData();
+      const size_t size = encodedSize();
+      const size_t soc = findCodestream_(data, size);
+      if(soc + 42 > size || readUint16BE_(data + soc + 2) != 0xFF51) {
+        return true;
+      }
+      const uint8_t* siz = data + soc + 6; // Rsiz
+      const uint64_t x1 = readUint32BE_(siz + 2);
+      const uint64_t y1 = readUint32BE_(siz + 6);
+      const uint64_t x0 = readUint32BE_(siz + 10);
+      const uint64_t y0 = readUint32BE_(siz + 14);
+      const uint64_t tileWidth = std::max<uint64_t>(1, readUint32BE_(siz + 18));
+      const uint64_t tileHeight = std::max<uint64_t>(1, readUint32BE_(siz + 22));
+      const uint64_t tx0 = readUint32BE_(siz + 26);
+      const uint64_t ty0 = readUint32BE_(siz + 30);
+      const size_t numComponents = readUint16BE_(siz + 34);
+      if(x1 <= x0 || y1 <= y0 || x0 < tx0 || y0 < ty0) {
+        return true;
+      }
+      const uint64_t pixels = (x1 - x0) * (y1 - y0);
+      const uint64_t tiles = ceilDivU64_(x1 - tx0, tileWidth) * ceilDivU64_(y1 - ty0, tileHeight);
+      if(limits_.maxPixels && pixels > limits_.maxPixels) {
+        diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::LimitExceeded, "J2KDecoder: %llu pixels exceeds the limit of %zu", (unsigned long long)pixels, limits_.maxPixels);
+        return false;
+      }
+      if(limits_.maxComponents && numComponents > limits_.maxComponents) {
+        diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::LimitExceeded, "J2KDecoder: %zu components exceeds the limit of %zu", numComponents, limits_.maxComponents);
+        return false;
+      }
+      if(limits_.maxTiles && tiles > limits_.maxTiles) {
+        diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::LimitExceeded, "J2KDecoder: %llu tiles exceeds the limit of %zu", (unsigned long long)tiles, limits_.maxTiles);
+        return false;
+      }
+      const uint8_t* components = siz + 36;
+      const size_t available = std::min<size_t>(numComponents, (size - (soc + 42)) / 3);
+      if(limits_.maxCodeBlocks) {
+        const double codeBlocks = countCodeBlocks_(x0, y0, x1, y1, tiles, components, available, decompositionLevel);
+        if(codeBlocks > limits_.maxCodeBlocks) {
+          diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::LimitExceeded, "J2KDecoder: %.0f code-blocks exceeds the limit of %zu", codeBlocks, limits_.maxCodeBlocks);
+          return false;
+        }
+      }
+      if(!limits_.maxMemory) {
+        return true;
+      }
+      // int32 planes (and the tile buffer for tiled images) at the reduced
+      // resolution plus the decoded buffer, like estimateDecode()
+      uint64_t memory = 0;
+      for(size_t c = 0; c < available; c++) {
+        const uint64_t bytesPerSample = ((components[c * 3] & 0x7F) + 1 + 7) / 8;
+        const uint64_t dx = std::max<uint8_t>(1, components[c * 3 + 1]);
+        const uint64_t dy = std::max<uint8_t>(1, components[c * 3 + 2]);
+        const uint64_t width = ceilDivPow2U64_(ceilDivU64_(x1, dx) - ceilDivU64_(x0, dx), decompositionLevel);
+        const uint64_t height = ceilDivPow2U64_(ceilDivU64_(y1, dy) - ceilDivU64_(y0, dy), decompositionLevel);
+        memory += width * height * (4 + bytesPerSample);
+        if(tiles > 1) {
+          memory += ceilDivPow2U64_(std::min(tileWidth, ceilDivU64_(x1, dx)), decompositionLevel) *
+                    ceilDivPow2U64_(std::min(tileHeight, ceilDivU64_(y1, dy)), decompositionLevel) * 4;
+        }
+      }
+      if(memory > limits_.maxMemory) {
+        diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::LimitExceeded, "J2KDecoder: decoding needs %llu bytes, exceeds the limit of %zu", (unsigned long long)memory, limits_.maxMemory);
+        return false;
+      }
+      return true;
+    }
+
+    // Calls visit(marker, segment, length) for the marker segments of the
+    // main header (up to the first SOT) until visit returns true.  length
+    // includes the two length bytes before segment.  Returns true if visit
+    // did.
+    template<typename Visit>
+    static bool visitMainHeader_(const uint8_t* data, size_t size, Visit visit) {
+      size_t position = findCodestream_(data, size);
+      if(position == size) {
+        return false;
+      }
+      position += 2;
+      while(position + 4 <= size) {
+        const uint16_t marker = readUint16BE_(data + position);
+        if(marker == 0xFF90 || marker == 0xFF93 || (marker >> 8) != 0xFF) {
+          break;
+        }
+        const size_t length = readUint16BE_(data + position + 2);
+        if(length < 2 || position + 2 + length > size) {
+          break;
+        }
+        if(visit(marker, data + position + 4, length)) {
+          return true;
+        }
+        position += 2 + length;
+      }
+      return false;
+    }
+
+    // Scans the main header for the Part 15 bit of Pcap in CAP or the HT
+    // code-block style bit in COD
+    static bool scanHighThroughput_(const uint8_t* data, size_t size) {
+      return visitMainHeader_(data, size, [](uint16_t marker, const uint8_t* segment, size_t length) {
+        // CAP: Pcap bit 2^(32 - 15) signals Part 15
+        if(marker == 0xFF50 && length >= 6 && (readUint32BE_(segment) & 0x00020000)) {
+          return true;
+        }
+        // COD: Scod, SGcod (4), decompositions, xcb, ycb, code-block style
+        return marker == 0xFF52 && length >= 11 && (segment[8] & 0x40) != 0;
+      });
+    }
+
+    // width, height, components, bitsPerSample, layers, decomposition level
+    // and threads of the frames a layer cost was learned from
+    typedef std::tuple<uint32_t, uint32_t, uint16_t, uint8_t, uint16_t, size_t, size_t> LayerCostKey;
+
+    // Reads the LayerCostKey of the encoded bitstream from its SIZ and COD
+    // markers, returns the number of layers, 0 if they could not be read
+    size_t scanLayerCostKey_(size_t decompositionLevel, LayerCostKey& key) const {
+      uint32_t width = 0, height = 0;
+      uint16_t components = 0, layers = 0;
+      uint8_t bitsPerSample = 0;
+      visitMainHeader_(encodedData(), encodedSize(), [&](uint16_t marker, const uint8_t* segment, size_t length) {
+        // SIZ: Rsiz, Xsiz, Ysiz, XOsiz, YOsiz, tile size and offset, Csiz,
+        // Ssiz of the first component
+        if(marker == 0xFF51 && length >= 41) {
+          width = readUint32BE_(segment + 2) - std::min(readUint32BE_(segment + 2), readUint32BE_(segment + 10));
+          height = readUint32BE_(segment + 6) - std::min(readUint32BE_(segment + 6), readUint32BE_(segment + 14));
+          components = readUint16BE_(segment + 34);
+          bitsPerSample = (segment[36] & 0x7F) + 1;
+        }
+        // COD: Scod, progression order, layers, follows SIZ
+        if(marker == 0xFF52 && length >= 6) {
+          layers = readUint16BE_(segment + 2);
+          return true;
+        }
+        return false;
+      });
+      key = LayerCostKey(width, height, components, bitsPerSample, layers, decompositionLevel, numThreads_);
+      return width && height ? layers : 0;
+    }
+
+    // Returns the most layers whose estimated decode time fits milliseconds,
+    // at least 1.  costs[n] is the learned time to decode n layers, 0 if not
+    // learned yet.  Times of other counts are interpolated between learned
+    // ones, scaled from the learned count below when there is none above
+    // and bounded by the learned count above when there is none below.
+    // Until some time is learned all layers are decoded.
+    static size_t chooseLayers_(const std::vector<double>& costs, double milliseconds) {
+      const size_t numLayers = costs.size() - 1;
+      size_t below = numLayers; // the largest learned count below layers
+      size_t above = 0;         // the smallest learned count above layers
+      for(size_t layers = numLayers; layers > 1; layers--) {
+        while(below > 0 && (below >= layers || costs[below] == 0)) {
+          below--;
+        }
+        double estimate = costs[layers];
+        if(estimate == 0) {
+          if(below && above) {
+            estimate = costs[below] + (costs[above] - costs[below]) * (layers - below) / (above - below);
+          } else if(below) {
+            estimate = costs[below] * layers / below;
+          } else if(above) {
+            estimate = costs[above];
+          } else {
+            return numLayers;
+          }
+        }
+        if(estimate <= milliseconds) {
+          return layers;
+        }
+        if(costs[layers] > 0) {
+          above = layers;
+        }
+      }
+      return 1;
+    }
+
+    // Returns the number J2KEncoder recorded after text in a COM marker, at
+    // most 65536, 0 if there is none.  See J2KEncoder::setAutoBitDepth()
+    // and J2KEncoder::encodeVolume().
+    static size_t scanComment_(const uint8_t* data, size_t size, const char* text) {
+      size_t value = 0;
+      visitMainHeader_(data, size, [&value, text](uint16_t marker, const uint8_t* segment, size_t length) {
+        // COM: Rcom (1 = Latin text), text
+        const size_t prefix = strlen(text);
+        if(marker != 0xFF64 || length < 4 + prefix || readUint16BE_(segment) != 1 ||
+           memcmp(segment + 2, text, prefix) != 0) {
+          return false;
+        }
+        const uint8_t* end = segment + length - 2;
+        for(const uint8_t* digit = segment + 2 + prefix; digit < end && *digit >= '0' && *digit <= '9'; digit++) {
+          value = std::min<size_t>(value * 10 + (*digit - '0'), 65536);
+        }
+        return true;
+      });
+      return value;
+    }
+
+    static bool supportsHighThroughput_() {
+      int major = 0, minor = 0;
+      if(sscanf(opj_version(), "%d.%d", &major, &minor) != 2) {
+        return false;
+      }
+      return major > 2 || (major == 2 && minor >= 5);
+    }
+
+    bool readHeader_(opj_codec_t*& l_codec, opj_stream_t*& l_stream, opj_image_t*& image,
+                     opj_buffer_info_t& buffer_info, size_t decompositionLevel) {
       opj_dparameters_t parameters;
-      opj_codec_t* l_codec = NULL;
-      opj_image_t* image = NULL;
-      opj_stream_t *l_stream = NULL;
+
+      status_ = J2KStatus::Ok;
+      diagnostics_.clear();
+      cancellation_.start();
+
+      // the stream type is detected from the first 4 bytes
+      if(!encodedData() || encodedSize() < 4) {
+          diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::HeaderFailed, "J2KDecoder: %zu encoded bytes are too few for a header", encodedSize());
+          status_ = J2KStatus::Failed;
+          return false;
+      }
+      isHighThroughput_ = scanHighThroughput_(encodedData(), encodedSize());
+      if(isHighThroughput_ && !supportsHighThroughput_()) {
+          diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::Unsupported, "J2KDecoder: HTJ2K codestreams need openjp2 2.5 or later (found %s)", opj_version());
+          status_ = J2KStatus::Failed;
+          return false;
+      }
+      if(!checkLimits_(decompositionLevel)) {
+          status_ = J2KStatus::LimitExceeded;
+          return false;
+      }
 
       // detect stream type
       // NOTE: DICOM only supports OPJ_CODEC_J2K, but not everyone follows this
       // and some DICOM images will have JP2 encoded bitstreams
       // http://dicom.nema.org/medical/dicom/2017e/output/chtml/part05/sect_A.4.4.html
-      if( ((OPJ_INT32*)encoded_.data())[0] == J2K_MAGIC_NUMBER ){
+      OPJ_INT32 magic;
+      memcpy(&magic, encodedData(), sizeof(magic));
+      if( magic == J2K_MAGIC_NUMBER ){
           l_codec = opj_create_decompress(OPJ_CODEC_J2K);
       }else{
           l_codec = opj_create_decompress(OPJ_CODEC_JP2);
       }
 
-      //opj_set_info_handler(l_codec, info_callback,00);
-      opj_set_warning_handler(l_codec, warning_callback,00);
-      opj_set_error_handler(l_codec, error_callback,00);
+      // openjp2 reports many warnings for valid streams, record them
+      // instead of printing each one.  Info messages are only formatted
+      // when they are printed.
+      if(diagnostics_.getVerbosity() > 2) {
+          opj_set_info_handler(l_codec, Diagnostics::infoCallback, &diagnostics_);
+      }
+      opj_set_warning_handler(l_codec, Diagnostics::warningCallback, &diagnostics_);
+      opj_set_error_handler(l_codec, Diagnostics::errorCallback, &diagnostics_);
 
       opj_set_default_decoder_parameters(&parameters);
       parameters.cp_reduce = decompositionLevel;
@@ -244,45 +1190,90 @@ class J2KDecoder {
 
       //opj_set_decoded_resolution_factor(l_codec, 1);
       // set stream
-      opj_buffer_info_t buffer_info;
-      buffer_info.buf = encoded_.data();
-      buffer_info.cur = encoded_.data();
-      buffer_info.len = encoded_.size();
+      buffer_info.buf = (OPJ_BYTE*)encodedData();
+      buffer_info.cur = (OPJ_BYTE*)encodedData();
+      buffer_info.len = encodedSize();
+      buffer_info.cancelled = CancellationToken::cancelledCallback;
+      buffer_info.client_data = &cancellation_;
       l_stream = opj_stream_create_buffer_stream(&buffer_info, OPJ_TRUE);
 
       /* Setup the decoder decoding parameters using user parameters */
       if ( !opj_setup_decoder(l_codec, &parameters) ){
-          printf("[ERROR] opj_decompress: failed to setup the decoder\n");
+          diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::SetupFailed, "opj_decompress: failed to setup the decoder");
+          status_ = failureStatus_();
           opj_stream_destroy(l_stream);
           opj_destroy_codec(l_codec);
-          return;
+          return false;
       }
       // disable strict mode so we can partially decode J2K streams
       opj_decoder_set_strict_mode(l_codec, OPJ_FALSE);
 
+      if(numThreads_) {
+          opj_codec_set_threads(l_codec, (int)numThreads_);
+      }
+
       /* Read the main header of the codestream and if necessary the JP2 boxes*/
       if(! opj_read_header(l_stream, l_codec, &image)){
-          printf("[ERROR] opj_decompress: failed to read the header\n");
+          diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::HeaderFailed, "opj_decompress: failed to read the header");
+          status_ = failureStatus_();
           opj_stream_destroy(l_stream);
           opj_destroy_codec(l_codec);
           opj_image_destroy(image);
-          return;
+          return false;
       }
-      
-      /* decode the image */
-      if (!opj_decode(l_codec, l_stream, image)) {
-          printf("[ERROR] opj_decompress: failed to decode tile!\n");
-          opj_destroy_codec(l_codec);
-          opj_stream_destroy(l_stream);
-          opj_image_destroy(image);
-          return;
+
+      // a volume has one component per slice, see J2KEncoder::encodeVolume()
+      numSlices_ = scanComment_(encodedData(), encodedSize(), J2K_VOLUME_COMMENT);
+      if(numSlices_ != image->numcomps || numSlices_ > UCHAR_MAX) {
+          numSlices_ = 0;
       }
+      return true;
+    }
 
+    // progressive and band decoding interleave the components, which are
+    // not the samples of a volume
+    bool rejectVolume_(opj_codec_t* l_codec, opj_stream_t* l_stream, opj_image_t* image) {
+      if(!numSlices_) {
+          return false;
+      }
+      diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::Unsupported, "J2KDecoder: volumes can only be decoded with decode(), decodeSubResolution() and decodeSlice()");
+      status_ = J2KStatus::Failed;
+      opj_stream_destroy(l_stream);
+      opj_destroy_codec(l_codec);
+      opj_image_destroy(image);
+      return true;
+    }
+
+    // Restricts decoding to the components of the slice pair of decodeSlice_
+    bool selectSlice_(opj_codec_t* l_codec) {
+      if(decodeSlice_ >= numSlices_) {
+          diagnostics_.addf(DiagnosticLevel::Error, DiagnosticCode::SetupFailed, "J2KDecoder: slice %zu out of range, the bitstream has %zu slices", decodeSlice_, numSlices_);
+          status_ = J2KStatus::Failed;
+          return false;
+      }
+      const OPJ_UINT32 first = (OPJ_UINT32)(decodeSlice_ & ~(size_t)1);
+      const OPJ_UINT32 components[] = {first, first + 1};
+      if(!opj_set_decoded_components(l_codec, first + 1 < numSlices_ ? 2 : 1, components, OPJ_FALSE)) {
+          diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::SetupFailed, "opj_decompress: failed to set the decoded components");
+          status_ = J2KStatus::Failed;
+          return false;
+      }
+      return true;
+    }
+
+    void readInfo_(opj_codec_t* l_codec, const opj_image_t* image) {
+      headerRead_ = true;
       frameInfo_.width = image->x1; 
       frameInfo_.height = image->y1;
-      frameInfo_.componentCount = image->numcomps;
+      frameInfo_.componentCount = numSlices_ && decodeSlice_ != SIZE_MAX ? 1 : image->numcomps;
       frameInfo_.isSigned = image->comps[0].sgnd;
       frameInfo_.bitsPerSample = image->comps[0].prec;
+      // restore the representation of auto bit depth encodes, the samples
+      // fit either way
+      const size_t bitsPerSample = scanComment_(encodedData(), encodedSize(), J2K_BITS_PER_SAMPLE_COMMENT);
+      if(bitsPerSample > (size_t)frameInfo_.bitsPerSample && bitsPerSample <= 16) {
+        frameInfo_.bitsPerSample = bitsPerSample;
+      }
 
       colorSpace_ = image->color_space;
       imageOffset_.x = image->x0;
@@ -300,23 +1291,413 @@ class J2KDecoder {
       tileSize_.width = cstr_info->tdx;
       tileSize_.height = cstr_info->tdy;
       numDecompositions_ = cstr_info->m_default_tile_info.tccp_info->numresolutions - 1;
+      opj_destroy_cstr_info(&cstr_info);
+    }
+
+    bool beginSession_() {
+      if(!readHeader_(sessionCodec_, sessionStream_, sessionImage_, sessionBuffer_, 0) ||
+         rejectVolume_(sessionCodec_, sessionStream_, sessionImage_)) {
+          sessionCodec_ = NULL;
+          sessionStream_ = NULL;
+          sessionImage_ = NULL;
+          return false;
+      }
+      readInfo_(sessionCodec_, sessionImage_);
+      // openjp2 keeps the tile data after decoding only for single tile
+      // images, tiled images have to be read again for every level
+      sessionReusable_ = (size_t)tileSize_.width >= frameInfo_.width - tileOffset_.x &&
+                         (size_t)tileSize_.height >= frameInfo_.height - tileOffset_.y;
+      sessionDecoded_ = false;
+      return true;
+    }
+
+    opj_image_t* decodeImage_(size_t decompositionLevel) {
+      opj_codec_t* l_codec = NULL;
+      opj_image_t* image = NULL;
+      opj_stream_t *l_stream = NULL;
+      opj_buffer_info_t buffer_info;
+
+      if(!readHeader_(l_codec, l_stream, image, buffer_info, decompositionLevel)) {
+          return NULL;
+      }
+      if(decodeSlice_ != SIZE_MAX && !selectSlice_(l_codec)) {
+          opj_destroy_codec(l_codec);
+          opj_stream_destroy(l_stream);
+          opj_image_destroy(image);
+          return NULL;
+      }
       
+      /* decode the image */
+      if (!opj_decode(l_codec, l_stream, image)) {
+          diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::DecodeFailed, "opj_decompress: failed to decode tile!");
+          status_ = failureStatus_();
+          opj_destroy_codec(l_codec);
+          opj_stream_destroy(l_stream);
+          opj_image_destroy(image);
+          return NULL;
+      }
+
+      // non strict mode treats a cancelled read as a truncated bitstream,
+      // discard whatever was decoded
+      if(cancellation_.isCancelled()) {
+          status_ = cancelledStatus_();
+          opj_destroy_codec(l_codec);
+          opj_stream_destroy(l_stream);
+          opj_image_destroy(image);
+          return NULL;
+      }
+
+      readInfo_(l_codec, image);
+
+      opj_stream_destroy(l_stream);
+      opj_destroy_codec(l_codec);
+      return image;
+    }
+
+    static size_t saturate_(uint64_t value) {
+      return value > (uint64_t)SIZE_MAX ? SIZE_MAX : (size_t)value;
+    }
+
+    // 64 bit versions for SIZ values, size_t is 32 bits in WASM
+    static uint64_t ceilDivU64_(uint64_t a, uint64_t b) {
+      return (a + b - 1) / b;
+    }
+
+    static uint64_t ceilDivPow2U64_(uint64_t a, size_t b) {
+      b = std::min<size_t>(b, 32);
+      return (a + ((uint64_t)1 << b) - 1) >> b;
+    }
+
+    static size_t ceilDiv_(size_t a, size_t b) {
+      return (a + b - 1) / b;
+    }
+
+    static size_t ceilDivPow2_(size_t a, size_t b) {
+      return (a + ((size_t)1 << b) - 1) >> b;
+    }
+
+    void resetStatistics_() {
+      statistics_.clear();
+      histograms_.clear();
+      if(!statisticsEnabled_) {
+        return;
+      }
+      const size_t bits = std::min<size_t>(frameInfo_.bitsPerSample, 31);
+      Statistics initial;
+      initial.minimum = INT_MAX;
+      initial.maximum = INT_MIN;
+      initial.histogramOffset = frameInfo_.isSigned ? -(1 << (bits - 1)) : 0;
+      initial.histogramBinWidth = histogramBins_ ? (double)((uint64_t)1 << bits) / histogramBins_ : 0;
+      statistics_.assign(frameInfo_.componentCount, initial);
+      histograms_.assign(frameInfo_.componentCount, std::vector<uint32_t>(histogramBins_, 0));
+    }
+
+    // Converts a row of samples to the native sample type like decode_i()
+    // and accumulates them into the component statistics
+    template<typename In, typename Out>
+    void convertRowWithStatistics_(const In* pIn, Out* pOut, size_t width, size_t stride,
+                                   int minValue, int maxValue, size_t component) {
+      Statistics& statistics = statistics_[component];
+      uint32_t* histogram = histograms_[component].data();
+      const int64_t numBins = histograms_[component].size();
+      const int64_t offset = statistics.histogramOffset;
+      const size_t bits = std::min<size_t>(frameInfo_.bitsPerSample, 31);
+      int minimum = statistics.minimum;
+      int maximum = statistics.maximum;
+      for (size_t x = 0; x < width; x++) {
+        int val = std::max(minValue, std::min((int)pIn[x], maxValue));
+        pOut[x * stride] = val;
+        minimum = std::min(minimum, val);
+        maximum = std::max(maximum, val);
+        if(numBins) {
+          const int64_t bin = ((val - offset) * numBins) >> bits;
+          histogram[std::max<int64_t>(0, std::min(bin, numBins - 1))]++;
+        }
+      }
+      statistics.minimum = minimum;
+      statistics.maximum = maximum;
+    }
+
+    // Converts a row of one component to the native sample type and stores
+    // it every stride samples from pixel in the decoded buffer, clamping
+    // like decode_i()
+    template<typename T>
+    void storeRow_(const T* pIn, size_t pixel, size_t columns, size_t component, size_t stride) {
+      if(statisticsEnabled_) {
+        if(frameInfo_.bitsPerSample <= 8 && frameInfo_.isSigned) {
+          convertRowWithStatistics_(pIn, (signed char*)&decoded_[pixel], columns, stride, SCHAR_MIN, SCHAR_MAX, component);
+        } else if(frameInfo_.bitsPerSample <= 8) {
+          convertRowWithStatistics_(pIn, (unsigned char*)&decoded_[pixel], columns, stride, 0, UCHAR_MAX, component);
+        } else if(frameInfo_.isSigned) {
+          convertRowWithStatistics_(pIn, (short*)&decoded_[pixel * 2], columns, stride, SHRT_MIN, SHRT_MAX, component);
+        } else {
+          convertRowWithStatistics_(pIn, (unsigned short*)&decoded_[pixel * 2], columns, stride, 0, USHRT_MAX, component);
+        }
+      } else if(frameInfo_.bitsPerSample <= 8 && frameInfo_.isSigned) {
+        signed char* pOut = (signed char*)&decoded_[pixel];
+        for (size_t x = 0; x < columns; x++) {
+          int val = pIn[x];
+          pOut[x * stride] = std::max(SCHAR_MIN, std::min(val, SCHAR_MAX));
+        }
+      } else if(frameInfo_.bitsPerSample <= 8) {
+        unsigned char* pOut = (unsigned char*)&decoded_[pixel];
+        for (size_t x = 0; x < columns; x++) {
+          int val = pIn[x];
+          pOut[x * stride] = std::max(0, std::min(val, UCHAR_MAX));
+        }
+      } else if(frameInfo_.isSigned) {
+        short* pOut = (short*)&decoded_[pixel * 2];
+        for (size_t x = 0; x < columns; x++) {
+          int val = pIn[x];
+          pOut[x * stride] = std::max(SHRT_MIN, std::min(val, SHRT_MAX));
+        }
+      } else {
+        unsigned short* pOut = (unsigned short*)&decoded_[pixel * 2];
+        for (size_t x = 0; x < columns; x++) {
+          int val = pIn[x];
+          pOut[x * stride] = std::max(0, std::min(val, USHRT_MAX));
+        }
+      }
+    }
+
+    // Copies one component of a tile decoded by opj_decode_tile_data() into
+    // the decoded buffer, clamping to the native sample type like decode_i()
+    template<typename T>
+    void storeTileComponent_(const T* pIn, size_t component, size_t x0, size_t y0,
+                             size_t width, size_t height, const Size& size) {
+      const size_t componentCount = frameInfo_.componentCount;
+      const size_t rows = std::min(height, size.height > y0 ? size.height - y0 : 0);
+      const size_t columns = std::min(width, size.width > x0 ? size.width - x0 : 0);
+      for (size_t y = 0; y < rows; y++, pIn += width) {
+        const size_t pixel = ((y0 + y) * (size_t)size.width + x0) * componentCount + component;
+        storeRow_(pIn, pixel, columns, component, componentCount);
+      }
+    }
+
+    void storeTile_(const opj_image_t* image, const uint8_t* tile, size_t decompositionLevel,
+                    size_t tx0, size_t ty0, size_t tx1, size_t ty1, const Size& size) {
+      // opj_decode_tile_data() stores each component in turn at the reduced
+      // resolution using 1, 2 or 4 bytes per sample depending on precision
+      for(size_t c = 0; c < image->numcomps; c++) {
+        const opj_image_comp_t& comp = image->comps[c];
+        const size_t x0 = ceilDivPow2_(ceilDiv_(tx0, comp.dx), decompositionLevel);
+        const size_t y0 = ceilDivPow2_(ceilDiv_(ty0, comp.dy), decompositionLevel);
+        const size_t width = ceilDivPow2_(ceilDiv_(tx1, comp.dx), decompositionLevel) - x0;
+        const size_t height = ceilDivPow2_(ceilDiv_(ty1, comp.dy), decompositionLevel) - y0;
+        const size_t originX = ceilDivPow2_(ceilDiv_(image->x0, comp.dx), decompositionLevel);
+        const size_t originY = ceilDivPow2_(ceilDiv_(image->y0, comp.dy), decompositionLevel);
+        size_t sampleSize = (comp.prec + 7) / 8;
+        if(sampleSize == 3) {
+          sampleSize = 4;
+        }
+        if(sampleSize == 1) {
+          if(comp.sgnd) {
+            storeTileComponent_((const int8_t*)tile, c, x0 - originX, y0 - originY, width, height, size);
+          } else {
+            storeTileComponent_((const uint8_t*)tile, c, x0 - originX, y0 - originY, width, height, size);
+          }
+        } else if(sampleSize == 2) {
+          if(comp.sgnd) {
+            storeTileComponent_((const int16_t*)tile, c, x0 - originX, y0 - originY, width, height, size);
+          } else {
+            storeTileComponent_((const uint16_t*)tile, c, x0 - originX, y0 - originY, width, height, size);
+          }
+        } else {
+          storeTileComponent_((const int32_t*)tile, c, x0 - originX, y0 - originY, width, height, size);
+        }
+        tile += width * height * sampleSize;
+      }
+    }
+
+#ifdef __EMSCRIPTEN__
+    // only an explicit false stops, a callback without a return continues
+    static bool callBand_(BandCallback& callback, size_t firstRow, size_t numRows) {
+      return !callback(firstRow, numRows).strictlyEquals(emscripten::val(false));
+    }
+#else
+    static bool callBand_(BandCallback& callback, size_t firstRow, size_t numRows) {
+      return callback(firstRow, numRows);
+    }
+#endif
+
+    void decodeBands_(size_t decompositionLevel, BandCallback& callback) {
+      opj_codec_t* l_codec = NULL;
+      opj_image_t* image = NULL;
+      opj_stream_t *l_stream = NULL;
+      opj_buffer_info_t buffer_info;
+
+      if(!readHeader_(l_codec, l_stream, image, buffer_info, decompositionLevel)) {
+          if(isStopped_()) {
+              std::vector<uint8_t>().swap(decoded_);
+          }
+          return;
+      }
+      if(rejectVolume_(l_codec, l_stream, image)) {
+          return;
+      }
+      // tiles are stored component by component as decoded, the upsampling
+      // and YCbCr conversion of convertColorImage_() need whole rows
+      if(isSubsampled_(image) || isYCbCr_(image)) {
+          diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::Unsupported, "J2KDecoder: decodeBands() does not support down sampled components or setConvertToRGB(), use decode()");
+          status_ = J2KStatus::Failed;
+          opj_stream_destroy(l_stream);
+          opj_destroy_codec(l_codec);
+          opj_image_destroy(image);
+          return;
+      }
+      readInfo_(l_codec, image);
+
+      Size sizeAtDecompositionLevel = calculateSizeAtDecompositionLevel(decompositionLevel);
+      const size_t bytesPerPixel = (frameInfo_.bitsPerSample + 8 - 1) / 8;
+      decoded_.resize((size_t)sizeAtDecompositionLevel.width * sizeAtDecompositionLevel.height * frameInfo_.componentCount * bytesPerPixel);
+      resetStatistics_();
+
+      // a band is one row of tiles, tiles may arrive in any order so count
+      // the tiles still missing in each row and emit bands top down
+      const size_t numTilesX = ceilDiv_(image->x1 - tileOffset_.x, tileSize_.width);
+      const size_t numTilesY = ceilDiv_(image->y1 - tileOffset_.y, tileSize_.height);
+      std::vector<size_t> tilesRemaining(numTilesY, numTilesX);
+      size_t nextTileRow = 0;
+
+      std::vector<uint8_t> tile;
+      OPJ_BOOL goOn = OPJ_TRUE;
+      while(goOn) {
+          OPJ_UINT32 tileIndex, dataSize, numComps;
+          OPJ_INT32 tx0, ty0, tx1, ty1;
+          if(!opj_read_tile_header(l_codec, l_stream, &tileIndex, &dataSize, &tx0, &ty0, &tx1, &ty1, &numComps, &goOn)) {
+              diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::DecodeFailed, "opj_decompress: failed to read tile header");
+              status_ = failureStatus_();
+              break;
+          }
+          if(!goOn) {
+              break;
+          }
+          tile.resize(dataSize);
+          if(!opj_decode_tile_data(l_codec, tileIndex, tile.data(), dataSize, l_stream) ||
+             cancellation_.isCancelled()) {
+              diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::DecodeFailed, "opj_decompress: failed to decode tile!");
+              status_ = failureStatus_();
+              break;
+          }
+          storeTile_(image, tile.data(), decompositionLevel, tx0, ty0, tx1, ty1, sizeAtDecompositionLevel);
+
+          const size_t tileRow = tileIndex / numTilesX;
+          if(tileRow < numTilesY && tilesRemaining[tileRow]) {
+              tilesRemaining[tileRow]--;
+          }
+          while(nextTileRow < numTilesY && tilesRemaining[nextTileRow] == 0) {
+              const size_t y0 = std::max<size_t>(image->y0, tileOffset_.y + nextTileRow * tileSize_.height);
+              const size_t y1 = std::min<size_t>(image->y1, tileOffset_.y + (nextTileRow + 1) * tileSize_.height);
+              const size_t originY = ceilDivPow2_(image->y0, decompositionLevel);
+              const size_t firstRow = ceilDivPow2_(y0, decompositionLevel) - originY;
+              const size_t lastRow = std::min<size_t>(ceilDivPow2_(y1, decompositionLevel) - originY, sizeAtDecompositionLevel.height);
+              nextTileRow++;
+              if(lastRow > firstRow && !callBand_(callback, firstRow, lastRow - firstRow)) {
+                  status_ = J2KStatus::Cancelled;
+                  goOn = OPJ_FALSE;
+                  break;
+              }
+          }
+      }
+
+      if(status_ == J2KStatus::Ok && cancellation_.isCancelled()) {
+          status_ = cancelledStatus_();
+      }
+      if(status_ == J2KStatus::Ok) {
+          opj_end_decompress(l_codec, l_stream);
+      } else if(isStopped_()) {
+          std::vector<uint8_t>().swap(decoded_);
+      }
+
+      opj_stream_destroy(l_stream);
+      opj_destroy_codec(l_codec);
+      opj_image_destroy(image);
+    }
+
+    void decode_i(size_t decompositionLevel) {
+      opj_image_t* image = decodeImage_(decompositionLevel);
+      if(!image) {
+          if(isStopped_()) {
+              std::vector<uint8_t>().swap(decoded_);
+          }
+          return;
+      }
+      if(numSlices_) {
+          convertVolume_(image, decompositionLevel);
+      } else {
+          convertImage_(image, decompositionLevel);
+      }
+      opj_image_destroy(image);
+    }
+
+    // Undoes the inter-slice transform of J2KEncoder::encodeVolume() in
+    // place and stores the slices one after the other in the decoded buffer
+    void convertVolume_(opj_image_t* image, size_t decompositionLevel) {
+      const Size size = calculateSizeAtDecompositionLevel(decompositionLevel);
+      const size_t numPixels = (size_t)size.width * size.height;
+      const size_t bytesPerPixel = (frameInfo_.bitsPerSample + 8 - 1) / 8;
+      decoded_.resize(numPixels * frameInfo_.componentCount * bytesPerPixel);
+      resetStatistics_();
+
+      // pairs of (floor of the mean, difference) components, the last slice
+      // of an odd count is stored as is
+      for(OPJ_UINT32 c = 0; c + 1 < image->numcomps; c += 2) {
+        OPJ_INT32* low = image->comps[c].data;
+        OPJ_INT32* high = image->comps[c + 1].data;
+        for(size_t i = 0; i < numPixels; i++) {
+          const OPJ_INT32 second = low[i] - (high[i] >> 1);
+          low[i] = second + high[i];
+          high[i] = second;
+        }
+      }
+
+      // image component c is slice first + c
+      const size_t first = decodeSlice_ == SIZE_MAX ? 0 : decodeSlice_ & ~(size_t)1;
+      for(OPJ_UINT32 c = 0; c < image->numcomps; c++) {
+        if(decodeSlice_ == SIZE_MAX) {
+          storeRow_(image->comps[c].data, c * numPixels, numPixels, c, 1);
+        } else if(first + c == decodeSlice_) {
+          storeRow_(image->comps[c].data, 0, numPixels, 0, 1);
+        }
+      }
+    }
+
+    void convertImage_(const opj_image_t* image, size_t decompositionLevel) {
       // calculate the resolution at the requested decomposition level and
       // allocate destination buffer
       Size sizeAtDecompositionLevel = calculateSizeAtDecompositionLevel(decompositionLevel);
       const size_t bytesPerPixel = (frameInfo_.bitsPerSample + 8 - 1) / 8;
-      const size_t destinationSize = sizeAtDecompositionLevel.width * sizeAtDecompositionLevel.height * frameInfo_.componentCount * bytesPerPixel;
+      const size_t destinationSize = (size_t)sizeAtDecompositionLevel.width * sizeAtDecompositionLevel.height * frameInfo_.componentCount * bytesPerPixel;
       decoded_.resize(destinationSize);
 
+      resetStatistics_();
+      // the loops below handle full resolution 1 component and 8 bit 3
+      // component images
+      if(isSubsampled_(image) || (frameInfo_.componentCount > 1 &&
+         (frameInfo_.componentCount != 3 || frameInfo_.bitsPerSample > 8 || isYCbCr_(image)))) {
+        convertColorImage_(image, sizeAtDecompositionLevel);
+        return;
+      }
+      if(statisticsEnabled_) {
+        convertImageWithStatistics_(image, sizeAtDecompositionLevel);
+        return;
+      }
+
       // Convert from int32 to native size
       int comp_num;
-      for (int y = 0; y < sizeAtDecompositionLevel.height; y++)
+      for (size_t y = 0; y < sizeAtDecompositionLevel.height; y++)
       {
         size_t lineStartPixel = y * sizeAtDecompositionLevel.width;
         size_t lineStart = lineStartPixel * frameInfo_.componentCount * bytesPerPixel;
         if(frameInfo_.componentCount == 1) {
-          int* pIn = (int*)&(image->comps[0].data[y * sizeAtDecompositionLevel.width]);
-          if(frameInfo_.bitsPerSample <= 8) {
+          int* pIn = (int*)&(image->comps[0].data[lineStartPixel]);
+          if(frameInfo_.bitsPerSample <= 8 && frameInfo_.isSigned) {
+              signed char* pOut = (signed char*)&decoded_[lineStart];
+              for (size_t x = 0; x < sizeAtDecompositionLevel.width; x++) {
+                int val = pIn[x];
+                pOut[x] = std::max(SCHAR_MIN, std::min(val, SCHAR_MAX));
+              }
+          } else if(frameInfo_.bitsPerSample <= 8) {
               unsigned char* pOut = (unsigned char*)&decoded_[lineStart];
               for (size_t x = 0; x < sizeAtDecompositionLevel.width; x++) {
                 int val = pIn[x];;
@@ -363,17 +1744,134 @@ class J2KDecoder {
             }*/
         }
       }
+    }
 
-      opj_stream_destroy(l_stream);
-      opj_destroy_codec(l_codec);
-      opj_image_destroy(image);
+    static bool isSubsampled_(const opj_image_t* image) {
+      for(OPJ_UINT32 c = 0; c < image->numcomps; c++) {
+        if(image->comps[c].dx > 1 || image->comps[c].dy > 1) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // YCbCr that openjp2 did not already convert with the inverse MCT
+    bool isYCbCr_(const opj_image_t* image) const {
+      return convertToRGB_ && image->numcomps == 3 &&
+        (image->color_space == OPJ_CLRSPC_SYCC || isSubsampled_(image));
+    }
+
+    // Row y of a component at the resolution of the first component,
+    // replicating down sampled samples.  Full resolution rows are returned
+    // without copying.
+    static const int* upsampleRow_(const opj_image_comp_t& comp, size_t y, size_t width, int* scratch) {
+      const size_t cy = std::min<size_t>(y / comp.dy, comp.h - 1);
+      const int* pIn = &comp.data[cy * comp.w];
+      if(comp.dx == 1 && comp.w >= width) {
+        return pIn;
+      }
+      if(comp.dx == 2) {
+        const size_t pairs = std::min<size_t>(width / 2, comp.w);
+        for(size_t x = 0; x < pairs; x++) {
+          scratch[x * 2] = pIn[x];
+          scratch[x * 2 + 1] = pIn[x];
+        }
+        for(size_t x = pairs * 2; x < width; x++) {
+          scratch[x] = pIn[std::min<size_t>(x / 2, comp.w - 1)];
+        }
+        return scratch;
+      }
+      for(size_t x = 0; x < width; x++) {
+        scratch[x] = pIn[std::min<size_t>(x / comp.dx, comp.w - 1)];
+      }
+      return scratch;
+    }
+
+    // ITU-R BT.601 full range YCbCr to RGB in 16 bit fixed point, like
+    // openjp2's sycc_to_rgb()
+    static void yccToRGBRow_(const int* pY, const int* pCb, const int* pCr, int* pR, int* pG, int* pB,
+                             size_t width, int offset, int minValue, int maxValue) {
+      for(size_t x = 0; x < width; x++) {
+        const int y = pY[x];
+        const int cb = pCb[x] - offset;
+        const int cr = pCr[x] - offset;
+        pR[x] = std::max(minValue, std::min(y + ((91881 * cr + 32768) >> 16), maxValue));
+        pG[x] = std::max(minValue, std::min(y - ((22554 * cb + 46802 * cr + 32768) >> 16), maxValue));
+        pB[x] = std::max(minValue, std::min(y + ((116130 * cb + 32768) >> 16), maxValue));
+      }
+    }
+
+    // Interleaves multi component images one row at a time: down sampled
+    // components are upsampled and YCbCr converted to RGB into row sized
+    // scratch buffers that stay in cache, then stored (and accumulated into
+    // the statistics) like single component images
+    void convertColorImage_(const opj_image_t* image, const Size& size) {
+      const size_t componentCount = frameInfo_.componentCount;
+      const bool toRGB = isYCbCr_(image);
+      std::vector<int> scratch(size.width * componentCount * (toRGB ? 2 : 1));
+      std::vector<const int*> rows(componentCount);
+      const size_t prec = std::min<size_t>(image->comps[0].prec, 31);
+      const int offset = (toRGB && !image->comps[1].sgnd) ? 1 << (prec - 1) : 0;
+      const int minValue = image->comps[0].sgnd ? -(1 << (prec - 1)) : 0;
+      const int maxValue = image->comps[0].sgnd ? (1 << (prec - 1)) - 1 : (int)((1u << prec) - 1);
+      for (size_t y = 0; y < size.height; y++) {
+        for (size_t c = 0; c < componentCount; c++) {
+          rows[c] = upsampleRow_(image->comps[c], y, size.width, &scratch[c * size.width]);
+        }
+        if(toRGB) {
+          int* pRGB = &scratch[componentCount * size.width];
+          yccToRGBRow_(rows[0], rows[1], rows[2], pRGB, pRGB + size.width, pRGB + size.width * 2,
+                       size.width, offset, minValue, maxValue);
+          for (size_t c = 0; c < componentCount; c++) {
+            rows[c] = pRGB + c * size.width;
+          }
+        }
+        const size_t pixel = y * size.width * componentCount;
+        for (size_t c = 0; c < componentCount; c++) {
+          storeRow_(rows[c], pixel + c, size.width, c, componentCount);
+        }
+      }
+    }
+
+    void convertImageWithStatistics_(const opj_image_t* image, const Size& size) {
+      const size_t componentCount = frameInfo_.componentCount;
+      const size_t bytesPerPixel = (frameInfo_.bitsPerSample + 8 - 1) / 8;
+      for (size_t y = 0; y < size.height; y++) {
+        const size_t lineStartPixel = y * size.width;
+        const size_t lineStart = lineStartPixel * componentCount * bytesPerPixel;
+        for (size_t c = 0; c < componentCount; c++) {
+          const int* pIn = &image->comps[c].data[lineStartPixel];
+          if(frameInfo_.bitsPerSample <= 8 && frameInfo_.isSigned) {
+            convertRowWithStatistics_(pIn, (signed char*)&decoded_[lineStart] + c, size.width, componentCount, SCHAR_MIN, SCHAR_MAX, c);
+          } else if(frameInfo_.bitsPerSample <= 8) {
+            convertRowWithStatistics_(pIn, (unsigned char*)&decoded_[lineStart] + c, size.width, componentCount, 0, UCHAR_MAX, c);
+          } else if(frameInfo_.isSigned) {
+            convertRowWithStatistics_(pIn, (short*)&decoded_[lineStart] + c, size.width, componentCount, SHRT_MIN, SHRT_MAX, c);
+          } else {
+            convertRowWithStatistics_(pIn, (unsigned short*)&decoded_[lineStart] + c, size.width, componentCount, 0, USHRT_MAX, c);
+          }
+        }
+      }
     }
 
     std::vector<uint8_t> encoded_;
+    const uint8_t* encodedData_;
+    size_t encodedSize_;
     std::vector<uint8_t> decoded_;
+    std::vector<std::vector<uint8_t>> pyramid_;
+    size_t numThreads_;
+    CancellationToken cancellation_;
+    J2KStatus status_;
+    Diagnostics diagnostics_;
+    double timeLimit_;
+    DecodeLimits limits_;
     FrameInfo frameInfo_;
+    // true once frameInfo_ and the other header fields describe the current
+    // encoded bytes, false again when they are replaced
+    bool headerRead_;
     size_t numDecompositions_;
     bool isReversible_;
+    bool isHighThroughput_;
     int progressionOrder_;
     Point imageOffset_;
     Size tileSize_;
@@ -382,6 +1880,24 @@ class J2KDecoder {
     int32_t numLayers_;
     size_t colorSpace_;
 
+    size_t numSlices_;
     size_t decodeLayer_;
+    size_t decodeSlice_;
+    std::map<LayerCostKey, std::vector<double>> layerCosts_;
+
+    bool statisticsEnabled_;
+    size_t histogramBins_;
+    std::vector<Statistics> statistics_;
+    std::vector<std::vector<uint32_t>> histograms_;
+
+    bool convertToRGB_;
+
+    // progressive decode session, see beginProgressiveDecode()
+    opj_codec_t* sessionCodec_;
+    opj_stream_t* sessionStream_;
+    opj_image_t* sessionImage_;
+    opj_buffer_info_t sessionBuffer_;
+    bool sessionReusable_;
+    bool sessionDecoded_;
 };
 
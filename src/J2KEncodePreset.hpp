@@ -0,0 +1,27 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+/// <summary>
+/// Named lossless encoder settings, see J2KEncoder::setPreset().  Use the
+/// autotune benchmark (test/cpp/autotune.cpp) to compare them with other
+/// settings on your own images
+/// </summary>
+enum class J2KEncodePreset {
+    /// <summary>
+    /// 3 decompositions, 64x64 blocks and selective arithmetic coding
+    /// bypass: the fastest encode at a small cost in size
+    /// </summary>
+    FastestLossless = 0,
+
+    /// <summary>
+    /// The defaults: 5 decompositions, 64x64 blocks, RPCL
+    /// </summary>
+    Balanced = 1,
+
+    /// <summary>
+    /// 6 decompositions and 64x64 blocks: the smallest bitstream
+    /// </summary>
+    Smallest = 2
+};
@@ -4,7 +4,11 @@
 #pragma once
 
 #include <exception>
+#include <math.h>
+#include <limits>
 #include <memory>
+#include <stdio.h>
+#include <string>
 
 
 #include "openjpeg.h"
@@ -12,18 +16,27 @@
 #include <stdlib.h>
 #define EMSCRIPTEN_API __attribute__((used))
 #define J2K_MAGIC_NUMBER 0x51FF4FFF
+// COM marker text recording the bitsPerSample of auto bit depth encodes
+#define J2K_BITS_PER_SAMPLE_COMMENT "openjpegjs bitsPerSample="
+// COM marker text recording the number of slices of volume encodes
+#define J2K_VOLUME_COMMENT "openjpegjs volume="
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten/val.h>
 #endif
 
 #include "BufferStream.hpp"
+#include "CancellationToken.hpp"
+#include "Diagnostics.hpp"
+#include "Estimate.hpp"
 #include "FrameInfo.hpp"
+#include "J2KEncodePreset.hpp"
+#include "J2KStatus.hpp"
 #include "Point.hpp"
 #include "Size.hpp"
 
 /// <summary>
-/// JavaScript API for encoding images to J2K bitstreams with OpenJPH
+/// JavaScript API for encoding images to J2K bitstreams with openjp2
 /// </summary>
 class J2KEncoder {
   public: 
@@ -31,10 +44,22 @@ class J2KEncoder {
   /// Constructor for encoding a HJ2K image from JavaScript.  
   /// </summary>
   J2KEncoder() :
+    decodedData_(NULL),
+    decodedSize_(0),
+    numThreads_(0),
+    status_(J2KStatus::Ok),
     decompositions_(5),
     lossless_(true),
     progressionOrder_(2), // RPCL
-    blockDimensions_(64,64)
+    blockDimensions_(64,64),
+    codeBlockStyle_(0),
+    targetSize_(0),
+    targetPSNR_(0),
+    measurePSNR_(false),
+    psnr_(0),
+    autoBitDepth_(false),
+    encodedBitsPerSample_(0),
+    volume_(false)
   {
   }
 
@@ -55,7 +80,7 @@ class J2KEncoder {
   emscripten::val getDecodedBuffer(const FrameInfo& frameInfo) {
     frameInfo_ = frameInfo;
     const size_t bytesPerPixel = (frameInfo_.bitsPerSample + 8 - 1) / 8;
-    const size_t decodedSize = frameInfo_.width * frameInfo_.height * frameInfo_.componentCount * bytesPerPixel;
+    const size_t decodedSize = (size_t)frameInfo_.width * frameInfo_.height * frameInfo_.componentCount * bytesPerPixel;
     downSamples_.resize(frameInfo_.componentCount);
     for (int c = 0; c < frameInfo_.componentCount; ++c) {
         downSamples_[c].x = 1;
@@ -76,6 +101,19 @@ class J2KEncoder {
   emscripten::val getEncodedBuffer() {
     return emscripten::val(emscripten::typed_memory_view(encoded_.size(), encoded_.data()));
   }
+
+  /// <summary>
+  /// Copies the pixel data described by frameInfo from a TypedArray, encodes
+  /// it and returns a TypedArray of the encoded bitstream in one call,
+  /// instead of getDecodedBuffer(), encode() and getEncodedBuffer().  The
+  /// TypedArray is empty if the encode failed, see getStatus().
+  /// </summary>
+  emscripten::val encodeFrame(emscripten::val decoded, const FrameInfo& frameInfo) {
+    getDecodedBuffer(frameInfo).call<void>("set", decoded);
+    encode();
+    const size_t size = status_ == J2KStatus::Ok ? encoded_.size() : 0;
+    return emscripten::val(emscripten::typed_memory_view(size, encoded_.data()));
+  }
 #else
   /// <summary>
   /// Returns the buffer to store the decoded bytes.  This method is not
@@ -88,9 +126,23 @@ class J2KEncoder {
         downSamples_[c].x = 1;
         downSamples_[c].y = 1;
     }
+    decodedData_ = NULL;
+    decodedSize_ = 0;
     return decoded_;
   }
 
+  /// <summary>
+  /// Encodes from caller owned memory instead of the internal decoded buffer
+  /// so the pixel data does not need to be copied.  The memory must remain
+  /// valid until encode() returns.  This method is not exported to
+  /// JavaScript, it is intended to be called by C++ code
+  /// </summary>
+  void setDecodedBytes(const uint8_t* data, size_t size, const FrameInfo& frameInfo) {
+    getDecodedBytes(frameInfo);
+    decodedData_ = data;
+    decodedSize_ = size;
+  }
+
   /// <summary>
   /// Returns the buffer to store the encoded bytes.  This method is not
   /// exported to JavaScript, it is intended to be called by C++ code
@@ -127,6 +179,66 @@ class J2KEncoder {
     layerCompressionRatios_[layer] = compressionRatio;
   }
 
+  /// <summary>
+  /// Encodes a single layer no larger than the specified number of bytes,
+  /// 0 = disabled (default).  openjp2 codes every code-block once and then
+  /// truncates the coding passes with the best rate-distortion slope to fit
+  /// the budget, so one encode is enough.  Overrides setQuality() layers
+  /// and setTargetPSNR().
+  /// </summary>
+  void setTargetSize(size_t targetSize) {
+    targetSize_ = targetSize;
+  }
+
+  /// <summary>
+  /// Encodes a single layer aiming for the specified PSNR in dB, 0 =
+  /// disabled (default).  Like setTargetSize() the passes are selected after
+  /// coding in the same encode.  openjp2 selects them from its distortion
+  /// estimates, so the PSNR of the result is close to but not guaranteed to
+  /// reach the target; use setMeasurePSNR() to check it.  Overrides
+  /// setQuality() layers.
+  /// </summary>
+  void setTargetPSNR(float targetPSNR) {
+    targetPSNR_ = targetPSNR;
+  }
+
+  /// <summary>
+  /// Enables measuring the PSNR of the encoded bitstream against the source
+  /// image after each encode (see getPSNR()).  This decodes the bitstream
+  /// so it roughly doubles the cost of an encode.  Disabled by default.
+  /// </summary>
+  void setMeasurePSNR(bool measurePSNR) {
+    measurePSNR_ = measurePSNR;
+  }
+
+  /// <summary>
+  /// returns the PSNR in dB measured by the last encode, infinity if the
+  /// encode was lossless and 0 if it was not measured (see setMeasurePSNR())
+  /// </summary>
+  double getPSNR() const {
+    return psnr_;
+  }
+
+  /// <summary>
+  /// Enables encoding each component with the number of bits the pixel data
+  /// actually uses (e.g. 12 bit CT stored in 16 bit samples) instead of
+  /// bitsPerSample.  The range is found while copying the pixel data, the
+  /// original bitsPerSample is recorded in a COM marker so J2KDecoder
+  /// restores it.  Compression ratios and target sizes are relative to the
+  /// reduced precision.  Disabled by default.
+  /// </summary>
+  void setAutoBitDepth(bool autoBitDepth) {
+    autoBitDepth_ = autoBitDepth;
+  }
+
+  /// <summary>
+  /// returns the component precision used by the last encode(), less than
+  /// bitsPerSample when setAutoBitDepth() reduced it
+  /// </summary>
+  size_t getEncodedBitsPerSample() const {
+    return encodedBitsPerSample_;
+  }
+
   /// <summary>
   /// Sets the progression order 
   /// 0 = LRCP
@@ -140,7 +252,12 @@ class J2KEncoder {
   }
 
   /// <summary>
-  /// Sets the down sampling for component
+  /// Sets the down sampling for component, e.g. (2, 1) for the chroma
+  /// components of 4:2:2 and (2, 2) for 4:2:0.  When any component is down
+  /// sampled the pixel data is planar: each component at its down sampled
+  /// size (ceil(width / x) by ceil(height / y)), one after the other, and
+  /// three component images are coded as YCbCr without the multiple
+  /// component transform.  Must be called after getDecodedBuffer()
   /// </summary>
   void setDownSample(size_t component, Point downSample) {
     downSamples_[component] = downSample;
@@ -174,6 +291,46 @@ class J2KEncoder {
     blockDimensions_ = blockDimensions;
   }
 
+  /// <summary>
+  /// Sets the code-block coding style flags (COD SPcod), may be combined:
+  /// 1 = selective arithmetic coding bypass
+  /// 2 = reset context probabilities
+  /// 4 = termination on each coding pass
+  /// 8 = vertically causal context
+  /// 16 = predictable termination
+  /// 32 = segmentation symbols
+  /// </summary>
+  void setCodeBlockStyle(size_t codeBlockStyle) {
+    codeBlockStyle_ = codeBlockStyle;
+  }
+
+  /// <summary>
+  /// Applies a named set of lossless settings (single layer, no tiles or
+  /// precincts), see J2KEncodePreset
+  /// </summary>
+  void setPreset(J2KEncodePreset preset) {
+    lossless_ = true;
+    layerCompressionRatios_.assign(1, 0);
+    progressionOrder_ = 2; // RPCL
+    blockDimensions_ = Size(64, 64);
+    tileSize_ = Size();
+    precincts_.resize(0);
+    switch(preset) {
+      case J2KEncodePreset::FastestLossless:
+        decompositions_ = 3;
+        codeBlockStyle_ = 1;
+        break;
+      case J2KEncodePreset::Smallest:
+        decompositions_ = 6;
+        codeBlockStyle_ = 0;
+        break;
+      default:
+        decompositions_ = 5;
+        codeBlockStyle_ = 0;
+        break;
+    }
+  }
+
   /// <summary>
   /// Sets the number of precincts
   /// </summary>
@@ -182,153 +339,615 @@ class J2KEncoder {
   }
 
   /// <summary>
-  /// Sets the precinct for the specified level.  You must
-  /// call setNumPrecincts with the number of levels first
+  /// Sets the precinct for the specified level, level 0 is the highest
+  /// resolution and the last precinct is repeated for lower resolutions.
+  /// You must call setNumPrecincts with the number of levels first
   /// </summary>
   void setPrecinct(size_t level, Size precinct) {
     precincts_[level] = precinct;
   }
 
-  /**
-  sample error debug callback expecting no client object
-  */
-  static void error_callback(const char *msg, void *client_data)
-  {
-      (void)client_data;
-      fprintf(stdout, "[ERROR] %s", msg);
-  }
-  /**
-  sample warning debug callback expecting no client object
-  */
-  static void warning_callback(const char *msg, void *client_data)
-  {
-      (void)client_data;
-      fprintf(stdout, "[WARNING] %s", msg);
+  /// <summary>
+  /// Sets the number of threads openjp2 may use to encode, 0 = single
+  /// threaded.  Only has an effect when openjp2 is built with
+  /// OPJ_USE_THREAD (e.g. the native Node.js addon)
+  /// </summary>
+  void setNumThreads(size_t numThreads) {
+    numThreads_ = numThreads;
   }
-  /**
-  sample debug callback expecting no client object
-  */
-  static void info_callback(const char *msg, void *client_data)
-  {
-      (void)client_data;
-      fprintf(stdout, "[INFO] %s", msg);
+
+  /// <summary>
+  /// Estimates the memory and relative cost of encoding an image described
+  /// by frameInfo with the current settings, without encoding, so jobs can be
+  /// admitted against a memory budget
+  /// </summary>
+  Estimate estimateEncode(const FrameInfo& frameInfo) const {
+    const uint64_t samples = (uint64_t)frameInfo.width * frameInfo.height * frameInfo.componentCount;
+    const uint64_t bytesPerPixel = (frameInfo.bitsPerSample + 8 - 1) / 8;
+    const uint64_t threads = std::max<uint64_t>(1, numThreads_);
+    const uint64_t blockSamples = (uint64_t)blockDimensions_.width * blockDimensions_.height;
+
+    // openjp2 copies the image planes into the tile, keeps the coded data
+    // of every code-block (up to 4 bytes per sample) for rate allocation
+    // and needs a code-block buffer per thread
+    const uint64_t workspace = samples * 4 + samples * 4 + threads * blockSamples * 4;
+
+    // lossless typically halves the samples, lossy targets the last layer
+    double ratio = lossless_ ? 2.0 : 1.0;
+    if(!layerCompressionRatios_.empty() && layerCompressionRatios_.back() > 0) {
+      ratio = std::max<double>(ratio, layerCompressionRatios_.back());
+    }
+
+    Estimate estimate;
+    estimate.encodedBytes = saturate_(samples * bytesPerPixel); // see encodeImage()
+    estimate.imageBytes = saturate_(samples * 4);
+    estimate.workspaceBytes = saturate_(workspace);
+    estimate.decodedBytes = saturate_(samples * bytesPerPixel);
+    estimate.totalBytes = saturate_((uint64_t)estimate.encodedBytes + estimate.imageBytes + estimate.workspaceBytes + estimate.decodedBytes);
+    estimate.cost = samples + 8.0 * samples * bytesPerPixel / ratio;
+    return estimate;
   }
 
   /// <summary>
   /// Executes an J2K encode using the data in the source buffer.  The
   /// JavaScript code must copy the source image frame into the source
   /// buffer before calling this method.  See documentation on getSourceBytes()
-  /// above
+  /// above.  Returns getStatus(), see getDiagnostic() for the reason of a
+  /// failure.
   /// </summary>
-  void encode() {
-    opj_cparameters_t parameters;   /* compression parameters */
-    opj_stream_t *l_stream = 00;
-    opj_codec_t* l_codec = 00;
+  J2KStatus encode() {
+    CancellationToken::Scope operation(cancellation_);
     opj_image_t *image = NULL;
     
-    OPJ_COLOR_SPACE color_space = frameInfo_.componentCount > 1 ? OPJ_CLRSPC_SRGB : OPJ_CLRSPC_GRAY;
+    bool subsampled = false;
+    for (int i = 0; i < frameInfo_.componentCount; i++) {
+        subsampled = subsampled || downSamples_[i].x > 1 || downSamples_[i].y > 1;
+    }
+    OPJ_COLOR_SPACE color_space = frameInfo_.componentCount == 1 ? OPJ_CLRSPC_GRAY :
+                                  subsampled ? OPJ_CLRSPC_SYCC : OPJ_CLRSPC_SRGB;
     
     std::vector<opj_image_cmptparm_t> cmptparm;
     cmptparm.resize(frameInfo_.componentCount);
     /* initialize image components */
     for (int i = 0; i < frameInfo_.componentCount; i++) {
+        const OPJ_UINT32 dx = std::max<OPJ_UINT32>(1, downSamples_[i].x);
+        const OPJ_UINT32 dy = std::max<OPJ_UINT32>(1, downSamples_[i].y);
         cmptparm[i].prec = (OPJ_UINT32)frameInfo_.bitsPerSample;
         cmptparm[i].bpp = (OPJ_UINT32)frameInfo_.bitsPerSample;
         cmptparm[i].sgnd = (OPJ_UINT32)frameInfo_.isSigned;
-        cmptparm[i].dx = 1;//(OPJ_UINT32)(subsampling_dx * raw_cp->rawComps[i].dx);
-        cmptparm[i].dy = 1;//(OPJ_UINT32)(subsampling_dy * raw_cp->rawComps[i].dy);
-        cmptparm[i].w = (OPJ_UINT32)frameInfo_.width;
-        cmptparm[i].h = (OPJ_UINT32)frameInfo_.height;
+        cmptparm[i].dx = dx;
+        cmptparm[i].dy = dy;
+        cmptparm[i].x0 = (OPJ_UINT32)imageOffset_.x;
+        cmptparm[i].y0 = (OPJ_UINT32)imageOffset_.y;
+        cmptparm[i].w = (OPJ_UINT32)((frameInfo_.width + dx - 1) / dx);
+        cmptparm[i].h = (OPJ_UINT32)((frameInfo_.height + dy - 1) / dy);
     }
     image = opj_image_create((OPJ_UINT32)frameInfo_.componentCount, cmptparm.data(), color_space);
 
     /* set image offset and reference grid */
     image->x0 = (OPJ_UINT32)imageOffset_.x;
     image->y0 = (OPJ_UINT32)imageOffset_.y;
-    image->x1 = (OPJ_UINT32)frameInfo_.width; // TODO: revisit logic in terms of subsampling and offsets?
-    image->y1 = (OPJ_UINT32)frameInfo_.height; // TODO: revisit logic in terms of subsampling and offsets?
-
+    image->x1 = (OPJ_UINT32)frameInfo_.width; // TODO: revisit logic in terms of offsets?
+    image->y1 = (OPJ_UINT32)frameInfo_.height; // TODO: revisit logic in terms of offsets?
+
+    // interleaved pixel data, or planar (each component at its down sampled
+    // size, one after the other) when any component is down sampled
+    const uint8_t* decoded = decodedData();
+    int minimum = 0;
+    int maximum = 0;
     if(frameInfo_.bitsPerSample <= 8) {
-      if(frameInfo_.componentCount == 1) {
-        std::copy((uint8_t*)decoded_.data(), (uint8_t*)(decoded_.data() + decoded_.size()), image->comps[0].data);
+      if(frameInfo_.isSigned) {
+        copyComponents_((const int8_t*)decoded, image, subsampled, minimum, maximum);
       } else {
-        for(size_t compno = 0; compno < frameInfo_.componentCount; compno++) {
-          for(size_t i=0; i < frameInfo_.width * frameInfo_.height; i++) {
-            image->comps[compno].data[i] = decoded_.data()[(i * frameInfo_.componentCount) + compno];
-          }
-        }
+        copyComponents_((const uint8_t*)decoded, image, subsampled, minimum, maximum);
       }
     } else if(frameInfo_.bitsPerSample <= 16) {
       if(frameInfo_.isSigned) {
-        std::copy((short*)decoded_.data(), (short*)(decoded_.data() + decoded_.size()), image->comps[0].data);
+        copyComponents_((const int16_t*)decoded, image, subsampled, minimum, maximum);
       } else {
-        std::copy((unsigned short*)decoded_.data(), (unsigned short*)(decoded_.data() + decoded_.size()), image->comps[0].data);
+        copyComponents_((const uint16_t*)decoded, image, subsampled, minimum, maximum);
+      }
+    }
+
+    // fewer bitplanes for T1 to code, the decoder restores bitsPerSample
+    // from the comment
+    encodedBitsPerSample_ = frameInfo_.bitsPerSample;
+    if(autoBitDepth_) {
+      const size_t bitsPerSample = std::min<size_t>(frameInfo_.bitsPerSample, usedBits_(minimum, maximum, frameInfo_.isSigned));
+      if(bitsPerSample < frameInfo_.bitsPerSample) {
+        for(OPJ_UINT32 compno = 0; compno < image->numcomps; compno++) {
+          image->comps[compno].prec = (OPJ_UINT32)bitsPerSample;
+        }
+        comment_ = J2K_BITS_PER_SAMPLE_COMMENT + std::to_string(frameInfo_.bitsPerSample);
+        encodedBitsPerSample_ = bitsPerSample;
+      }
+    }
+
+    encodeImage(image);
+    comment_.clear();
+    opj_image_destroy(image);
+    return status_;
+  }
+
+  /// <summary>
+  /// Encodes the frameInfo.componentCount single component slices of a
+  /// series (e.g. adjacent CT slices) stored one after the other in the
+  /// decoded buffer as one volume.  Each pair of slices is replaced by the
+  /// floor of their mean and their difference (a reversible integer
+  /// transform, the difference needs one more bit) before coding, so the
+  /// correlation between adjacent slices is not coded twice.  Lossless
+  /// settings stay lossless.  J2KDecoder::decodeSlice() decodes a single
+  /// slice from the components of its pair, exactly at decomposition level
+  /// 0.  Returns getStatus().
+  /// </summary>
+  J2KStatus encodeVolume() {
+    CancellationToken::Scope operation(cancellation_);
+    const size_t numSlices = frameInfo_.componentCount;
+    // J2KDecoder reads at most 255 slices back (a FrameInfo component count)
+    if(numSlices == 0 || numSlices > std::numeric_limits<uint8_t>::max() || frameInfo_.bitsPerSample > 16) {
+      diagnostics_.clear();
+      diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::Unsupported, "J2KEncoder: volumes need 1 to 255 slices of up to 16 bits");
+      status_ = J2KStatus::Failed;
+      return status_;
+    }
+
+    std::vector<opj_image_cmptparm_t> cmptparm(numSlices);
+    for (size_t i = 0; i < numSlices; i++) {
+        // the second component of a pair holds the signed difference
+        const bool difference = i % 2 == 1;
+        cmptparm[i].prec = (OPJ_UINT32)frameInfo_.bitsPerSample + (difference ? 1 : 0);
+        cmptparm[i].bpp = cmptparm[i].prec;
+        cmptparm[i].sgnd = difference ? 1 : (OPJ_UINT32)frameInfo_.isSigned;
+        cmptparm[i].dx = 1;
+        cmptparm[i].dy = 1;
+        cmptparm[i].x0 = (OPJ_UINT32)imageOffset_.x;
+        cmptparm[i].y0 = (OPJ_UINT32)imageOffset_.y;
+        cmptparm[i].w = (OPJ_UINT32)frameInfo_.width;
+        cmptparm[i].h = (OPJ_UINT32)frameInfo_.height;
+    }
+    opj_image_t* image = opj_image_create((OPJ_UINT32)numSlices, cmptparm.data(), OPJ_CLRSPC_UNSPECIFIED);
+    image->x0 = (OPJ_UINT32)imageOffset_.x;
+    image->y0 = (OPJ_UINT32)imageOffset_.y;
+    image->x1 = (OPJ_UINT32)frameInfo_.width;
+    image->y1 = (OPJ_UINT32)frameInfo_.height;
+
+    const uint8_t* decoded = decodedData();
+    int minimum = 0;
+    int maximum = 0;
+    if(frameInfo_.bitsPerSample <= 8 && frameInfo_.isSigned) {
+      copyComponents_((const int8_t*)decoded, image, true, minimum, maximum);
+    } else if(frameInfo_.bitsPerSample <= 8) {
+      copyComponents_((const uint8_t*)decoded, image, true, minimum, maximum);
+    } else if(frameInfo_.isSigned) {
+      copyComponents_((const int16_t*)decoded, image, true, minimum, maximum);
+    } else {
+      copyComponents_((const uint16_t*)decoded, image, true, minimum, maximum);
+    }
+
+    // the last slice of an odd count is coded as is
+    const size_t numPixels = (size_t)frameInfo_.width * frameInfo_.height;
+    for(size_t c = 0; c + 1 < numSlices; c += 2) {
+      OPJ_INT32* first = image->comps[c].data;
+      OPJ_INT32* second = image->comps[c + 1].data;
+      for(size_t i = 0; i < numPixels; i++) {
+        const OPJ_INT32 difference = first[i] - second[i];
+        first[i] = second[i] + (difference >> 1);
+        second[i] = difference;
+      }
+    }
+
+    comment_ = J2K_VOLUME_COMMENT + std::to_string(numSlices);
+    encodedBitsPerSample_ = frameInfo_.bitsPerSample;
+    volume_ = true;
+    encodeImage(image);
+    volume_ = false;
+    comment_.clear();
+    opj_image_destroy(image);
+    return status_;
+  }
+
+  /// <summary>
+  /// Encodes an openjp2 image using the current settings.  The caller
+  /// retains ownership of the image struct but openjp2 takes the pixel
+  /// planes: every comps[].data is NULL afterwards (opj_image_destroy()
+  /// still works), so an image can only be encoded once - decode it again
+  /// to encode it with other settings.  This method is not exported to
+  /// JavaScript, it is intended to be called by C++ code (see J2KTranscoder).
+  /// Returns false if encoding failed
+  /// </summary>
+  bool encodeImage(opj_image_t* image) {
+    CancellationToken::Scope operation(cancellation_);
+    opj_cparameters_t parameters;   /* compression parameters */
+    opj_stream_t *l_stream = 00;
+    opj_codec_t* l_codec = 00;
+
+    status_ = J2KStatus::Ok;
+    diagnostics_.clear();
+    cancellation_.start();
+
+    for(OPJ_UINT32 compno = 0; compno < image->numcomps; compno++) {
+      if(!image->comps[compno].data) {
+        diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::SetupFailed, "J2KEncoder: the image has no pixel data, it was already encoded");
+        status_ = J2KStatus::Failed;
+        return false;
       }
     }
 
+    // each decomposition halves the resolution, clamp so the lowest
+    // resolution still has samples (e.g. when transcoding a sub resolution)
+    size_t decompositions = decompositions_;
+    const OPJ_UINT32 minDimension = std::min(image->comps[0].w, image->comps[0].h);
+    while(decompositions > 0 && (minDimension >> decompositions) == 0) {
+      decompositions--;
+    }
+
     /* set encoding parameters to default values */
     opj_set_default_encoder_parameters(&parameters);
-    parameters.tcp_mct = (char)frameInfo_.componentCount > 1 ? 1 : 0; // disable for grayscale: TODO - set this properly for color
+    // the multiple component transform needs three full size components
+    bool subsampled = false;
+    for(OPJ_UINT32 compno = 0; compno < image->numcomps; compno++) {
+      subsampled = subsampled || image->comps[compno].dx > 1 || image->comps[compno].dy > 1;
+    }
+    parameters.tcp_mct = (image->numcomps >= 3 && !subsampled && !volume_ && image->color_space != OPJ_CLRSPC_SYCC) ? 1 : 0;
     parameters.prog_order = (OPJ_PROG_ORDER)progressionOrder_;
-    parameters.numresolution = decompositions_ + 1;
+    parameters.numresolution = decompositions + 1;
     parameters.irreversible = !lossless_;
 
     parameters.tcp_numlayers = layerCompressionRatios_.size();
     for(size_t layer = 0; layer < layerCompressionRatios_.size(); layer++) {
       parameters.tcp_rates[layer] = layerCompressionRatios_[layer];
     }
+    // NOTE: openjp2 forms a layer with rate 0 (lossless) in a single pass
+    // without searching for a threshold, fixed allocation would need a
+    // cp_matrice so rate allocation stays on for single layer lossless too
     parameters.cp_disto_alloc = 1;
 
+    if(targetSize_) {
+      // opj_j2k_update_rates() turns a rate into a byte budget as
+      // numcomps * comps[0].prec bits per reference grid sample divided by
+      // comps[0].dx * dy, so invert that for the target (openjp2 subtracts
+      // the marker overhead itself)
+      const double bits = (double)image->numcomps * image->comps[0].prec *
+        (image->x1 - image->x0) * (image->y1 - image->y0) / ((double)image->comps[0].dx * image->comps[0].dy);
+      parameters.tcp_numlayers = 1;
+      parameters.tcp_rates[0] = (float)std::max(1.0, bits / (8.0 * targetSize_));
+    } else if(targetPSNR_ > 0) {
+      parameters.tcp_numlayers = 1;
+      parameters.tcp_distoratio[0] = targetPSNR_;
+      parameters.cp_disto_alloc = 0;
+      parameters.cp_fixed_quality = 1;
+    }
+
+    parameters.cblockw_init = blockDimensions_.width;
+    parameters.cblockh_init = blockDimensions_.height;
+    parameters.mode = (int)codeBlockStyle_;
+
+    if(tileSize_.width && tileSize_.height) {
+      parameters.tile_size_on = OPJ_TRUE;
+      parameters.cp_tx0 = tileOffset_.x;
+      parameters.cp_ty0 = tileOffset_.y;
+      parameters.cp_tdx = tileSize_.width;
+      parameters.cp_tdy = tileSize_.height;
+    }
+
+    if(!precincts_.empty()) {
+      parameters.csty |= 0x01;
+      parameters.res_spec = std::min<size_t>(precincts_.size(), OPJ_J2K_MAXRLVLS);
+      for(int i = 0; i < parameters.res_spec; i++) {
+        parameters.prcw_init[i] = precincts_[i].width;
+        parameters.prch_init[i] = precincts_[i].height;
+      }
+    }
+
+    // openjp2 copies the comment, the default names the openjp2 version
+    if(!comment_.empty()) {
+      parameters.cp_comment = (char*)comment_.c_str();
+    }
+
     // TODO: add support for JP2 encoding via config parameter
     l_codec = opj_create_compress(OPJ_CODEC_J2K);
 
     /* catch events using our callbacks and give a local context */
-    //opj_set_info_handler(l_codec, info_callback, 00);
-    opj_set_warning_handler(l_codec, warning_callback, 00);
-    opj_set_error_handler(l_codec, error_callback, 00);
-
-    // TODO: Add support for using tiles?
+    if(diagnostics_.getVerbosity() > 2) {
+      opj_set_info_handler(l_codec, Diagnostics::infoCallback, &diagnostics_);
+    }
+    opj_set_warning_handler(l_codec, Diagnostics::warningCallback, &diagnostics_);
+    opj_set_error_handler(l_codec, Diagnostics::errorCallback, &diagnostics_);
 
     if (! opj_setup_encoder(l_codec, &parameters, image)) {
-      fprintf(stderr, "failed to encode image: opj_setup_encoder\n");
+      diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::SetupFailed, "failed to encode image: opj_setup_encoder");
+      status_ = J2KStatus::Failed;
       opj_destroy_codec(l_codec);
-      opj_image_destroy(image);
-      return; // TODO: implement error handling
+      return false; // TODO: implement error handling
+    }
+
+    if(numThreads_) {
+      opj_codec_set_threads(l_codec, (int)numThreads_);
     }
 
     // HACK: For now - make encoded buffer the same size as decoded so we can
-    // avoid messing with BufferStream malloc/free stuff
-    encoded_.resize(decoded_.size());
+    // avoid messing with BufferStream malloc/free stuff.  Writes are bounds
+    // checked, the headroom covers markers and incompressible images that
+    // code slightly larger than the raw samples.
+    size_t decodedSize = 0;
+    for(OPJ_UINT32 compno = 0; compno < image->numcomps; compno++) {
+      decodedSize += (size_t)image->comps[compno].w * image->comps[compno].h * ((image->comps[compno].prec + 8 - 1) / 8);
+    }
+    encoded_.resize(decodedSize + decodedSize / 16 + 4096);
 
     /* open a byte stream for writing and allocate memory for all tiles */
     opj_buffer_info_t buffer_info;
     buffer_info.buf = encoded_.data();
     buffer_info.cur = encoded_.data();
     buffer_info.len = encoded_.size();
+    buffer_info.cancelled = CancellationToken::cancelledCallback;
+    buffer_info.client_data = &cancellation_;
     l_stream = opj_stream_create_buffer_stream(&buffer_info, OPJ_FALSE);
 
+    // opj_start_compress() moves the pixel planes out of image (the
+    // comps[].data pointers are NULL afterwards), keep a copy to measure
+    // the PSNR against
+    std::vector<std::vector<OPJ_INT32>> source;
+    if(measurePSNR_) {
+      source.resize(image->numcomps);
+      for(OPJ_UINT32 compno = 0; compno < image->numcomps; compno++) {
+        const opj_image_comp_t& component = image->comps[compno];
+        source[compno].assign(component.data, component.data + (size_t)component.w * component.h);
+      }
+    }
+
     /* encode the image */
     if (!opj_start_compress(l_codec, image, l_stream))  {
-        fprintf(stderr, "failed to encode image: opj_start_compress\n");
-        return; // todo: error handling
+        diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::EncodeFailed, "failed to encode image: opj_start_compress");
+        fail_();
+        opj_stream_destroy(l_stream);
+        opj_destroy_codec(l_codec);
+        return false; // todo: error handling
     }
 
     if(!opj_encode(l_codec, l_stream)) {
-      fprintf(stderr, "failed to encode image: opj_encode\n");
-      return; // todo: error handling
+      diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::EncodeFailed, "failed to encode image: opj_encode");
+      fail_();
+      opj_stream_destroy(l_stream);
+      opj_destroy_codec(l_codec);
+      return false; // todo: error handling
     }
 
     if(!opj_end_compress(l_codec, l_stream)) {
-      fprintf(stderr, "failed to encode image: opj_end_compress\n");
-      return; // todo: error handling
+      diagnostics_.add(DiagnosticLevel::Error, DiagnosticCode::EncodeFailed, "failed to encode image: opj_end_compress");
+      fail_();
+      opj_stream_destroy(l_stream);
+      opj_destroy_codec(l_codec);
+      return false; // todo: error handling
+    }
+
+    opj_stream_destroy(l_stream);
+    opj_destroy_codec(l_codec);
+
+    // a cancelled write can leave a truncated but "successful" bitstream
+    if(cancellation_.isCancelled()) {
+      fail_();
+      return false;
     }
 
     encoded_.resize(buffer_info.cur - buffer_info.buf);
+
+    psnr_ = 0;
+    if(measurePSNR_) {
+      psnr_ = computePSNR_(image, source);
+    }
+    return true;
+  }
+
+  /// <summary>
+  /// Requests that an encode running on another thread, or the next encode
+  /// if none is running, stops as soon as possible.  The encode returns with
+  /// getStatus() == Cancelled and the encoded buffer released.  Cancellation
+  /// is checked whenever openjp2 writes to the bitstream (about once per
+  /// tile) and between the encode phases.
+  /// </summary>
+  void cancel() {
+    cancellation_.cancel();
+  }
+
+  /// <summary>
+  /// Sets the maximum time in milliseconds an encode may take before it is
+  /// cancelled, 0 = no limit (default)
+  /// </summary>
+  void setTimeLimit(double milliseconds) {
+    cancellation_.setTimeLimit(milliseconds);
+  }
+
+  /// <summary>
+  /// returns the status of the last encode
+  /// </summary>
+  J2KStatus getStatus() const {
+    return status_;
+  }
+
+  /// <summary>
+  /// Sets which openjp2 and encoder messages are also printed to stdout:
+  /// 0 = none (default), 1 = errors, 2 = errors and warnings, 3 = all
+  /// </summary>
+  void setVerbosity(size_t verbosity) {
+    diagnostics_.setVerbosity(verbosity);
+  }
+
+  /// <summary>
+  /// returns the number of messages kept from the last encode, the most
+  /// recent 16
+  /// </summary>
+  size_t getNumDiagnostics() const {
+    return diagnostics_.size();
+  }
+
+  /// <summary>
+  /// returns a message kept from the last encode, 0 is the oldest
+  /// </summary>
+  Diagnostic getDiagnostic(size_t index) const {
+    if(index < diagnostics_.size()) {
+      return diagnostics_.get(index);
+    }
+    return Diagnostic();
+  }
+
+  /// <summary>
+  /// returns the number of errors reported by the last encode
+  /// </summary>
+  size_t getNumErrors() const {
+    return diagnostics_.getCount(DiagnosticLevel::Error);
+  }
+
+  /// <summary>
+  /// returns the number of warnings reported by the last encode
+  /// </summary>
+  size_t getNumWarnings() const {
+    return diagnostics_.getCount(DiagnosticLevel::Warning);
   }
 
   private:
+    static size_t saturate_(uint64_t value) {
+      return value > (uint64_t)SIZE_MAX ? SIZE_MAX : (size_t)value;
+    }
+
+    // Widens the pixel data into the image components in one pass, from
+    // planar data when planar is true, otherwise from interleaved data, and
+    // returns the range of the copied samples in minimum and maximum.
+    // Samples missing from a short buffer are left 0
+    template<typename T>
+    void copyComponents_(const T* pIn, opj_image_t* image, bool planar, int& minimum, int& maximum) {
+      const size_t available = decodedSize() / sizeof(T);
+      const size_t numComps = image->numcomps;
+      T low = std::numeric_limits<T>::max();
+      T high = std::numeric_limits<T>::min();
+      if(planar || numComps == 1) {
+        size_t position = 0;
+        for(size_t compno = 0; compno < numComps; compno++) {
+          const size_t count = (size_t)image->comps[compno].w * image->comps[compno].h;
+          const size_t copied = std::min(count, available > position ? available - position : 0);
+          const T* pSource = pIn + position;
+          OPJ_INT32* pOut = image->comps[compno].data;
+          for(size_t i = 0; i < copied; i++) {
+            const T value = pSource[i];
+            low = std::min(low, value);
+            high = std::max(high, value);
+            pOut[i] = value;
+          }
+          position += count;
+        }
+      } else {
+        const size_t count = std::min((size_t)image->comps[0].w * image->comps[0].h, available / numComps);
+        for(size_t compno = 0; compno < numComps; compno++) {
+          OPJ_INT32* pOut = image->comps[compno].data;
+          for(size_t i = 0; i < count; i++) {
+            const T value = pIn[i * numComps + compno];
+            low = std::min(low, value);
+            high = std::max(high, value);
+            pOut[i] = value;
+          }
+        }
+      }
+      minimum = low <= high ? low : 0;
+      maximum = low <= high ? high : 0;
+    }
+
+    // Returns the precision needed to represent samples from minimum to
+    // maximum, at least 1
+    static size_t usedBits_(int minimum, int maximum, bool isSigned) {
+      size_t bits = 1;
+      if(isSigned) {
+        // two's complement needs a sign bit above the magnitude of
+        // maximum and of -minimum - 1
+        const unsigned int magnitude = std::max(maximum, 0) | (minimum < 0 ? -(minimum + 1) : 0);
+        while(bits < 32 && (magnitude >> (bits - 1))) {
+          bits++;
+        }
+      } else {
+        while(bits < 32 && ((unsigned int)std::max(maximum, 0) >> bits)) {
+          bits++;
+        }
+      }
+      return bits;
+    }
+
+    // Decodes the encoded buffer and returns its PSNR against source, the
+    // pixel planes of image copied before it was encoded
+    double computePSNR_(const opj_image_t* image, const std::vector<std::vector<OPJ_INT32>>& source) {
+      opj_codec_t* l_codec = opj_create_decompress(OPJ_CODEC_J2K);
+      opj_set_warning_handler(l_codec, Diagnostics::warningCallback, &diagnostics_);
+      opj_set_error_handler(l_codec, Diagnostics::errorCallback, &diagnostics_);
+      opj_dparameters_t parameters;
+      opj_set_default_decoder_parameters(&parameters);
+
+      opj_buffer_info_t buffer_info;
+      buffer_info.buf = encoded_.data();
+      buffer_info.cur = encoded_.data();
+      buffer_info.len = encoded_.size();
+      buffer_info.cancelled = NULL;
+      buffer_info.client_data = NULL;
+      opj_stream_t* l_stream = opj_stream_create_buffer_stream(&buffer_info, OPJ_TRUE);
+
+      opj_image_t* decoded = NULL;
+      double psnr = 0;
+      if(opj_setup_decoder(l_codec, &parameters) &&
+         opj_read_header(l_stream, l_codec, &decoded) &&
+         opj_decode(l_codec, l_stream, decoded) &&
+         decoded->numcomps == image->numcomps) {
+        double squaredError = 0;
+        double peak = 0;
+        size_t numSamples = 0;
+        for(OPJ_UINT32 compno = 0; compno < image->numcomps; compno++) {
+          const opj_image_comp_t& component = image->comps[compno];
+          const opj_image_comp_t& result = decoded->comps[compno];
+          if(result.w != component.w || result.h != component.h) {
+            numSamples = 0;
+            break;
+          }
+          const OPJ_INT32* samples = source[compno].data();
+          const size_t count = (size_t)component.w * component.h;
+          for(size_t i = 0; i < count; i++) {
+            const double difference = (double)samples[i] - result.data[i];
+            squaredError += difference * difference;
+          }
+          numSamples += count;
+          peak = std::max(peak, (double)((1u << component.prec) - 1));
+        }
+        if(numSamples) {
+          psnr = squaredError == 0 ? INFINITY : 10.0 * log10(peak * peak / (squaredError / numSamples));
+        }
+      }
+
+      opj_image_destroy(decoded);
+      opj_stream_destroy(l_stream);
+      opj_destroy_codec(l_codec);
+      return psnr;
+    }
+
+    void fail_() {
+      if(cancellation_.isCancelled()) {
+        status_ = J2KStatus::Cancelled;
+        std::vector<uint8_t>().swap(encoded_);
+      } else {
+        status_ = J2KStatus::Failed;
+      }
+    }
+
+    const uint8_t* decodedData() const {
+      return decodedData_ ? decodedData_ : decoded_.data();
+    }
+
+    size_t decodedSize() const {
+      return decodedData_ ? decodedSize_ : decoded_.size();
+    }
+
     std::vector<uint8_t> decoded_;
+    const uint8_t* decodedData_;
+    size_t decodedSize_;
     std::vector<uint8_t> encoded_;
+    size_t numThreads_;
+    CancellationToken cancellation_;
+    J2KStatus status_;
+    Diagnostics diagnostics_;
 
     FrameInfo frameInfo_;
     size_t decompositions_;
@@ -342,4 +961,14 @@ class J2KEncoder {
     Point tileOffset_;
     Size blockDimensions_;
     std::vector<Size> precincts_;
+    size_t codeBlockStyle_;
+
+    size_t targetSize_;
+    float targetPSNR_;
+    bool measurePSNR_;
+    double psnr_;
+    bool autoBitDepth_;
+    size_t encodedBitsPerSample_;
+    std::string comment_;
+    bool volume_;
 };
@@ -0,0 +1,29 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+/// <summary>
+/// Result of the last decode/encode operation
+/// </summary>
+enum class J2KStatus {
+    /// <summary>
+    /// The operation completed
+    /// </summary>
+    Ok = 0,
+
+    /// <summary>
+    /// openjp2 reported an error (invalid or unsupported bitstream/settings)
+    /// </summary>
+    Failed = 1,
+
+    /// <summary>
+    /// The operation was stopped by cancel() or because its time limit expired
+    /// </summary>
+    Cancelled = 2,
+
+    /// <summary>
+    /// The bitstream exceeds a limit set with J2KDecoder::setLimits()
+    /// </summary>
+    LimitExceeded = 3
+};
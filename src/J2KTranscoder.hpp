@@ -0,0 +1,53 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "openjpeg.h"
+
+#include "J2KDecoder.hpp"
+#include "J2KEncoder.hpp"
+
+/// <summary>
+/// JavaScript API for re-encoding J2K bitstreams (e.g. producing lossy
+/// derivatives of lossless images).  The decoded openjp2 image is handed
+/// directly to the encoder so the pixels are never converted to native
+/// samples and back.
+/// </summary>
+class J2KTranscoder {
+  public:
+  /// <summary>
+  /// Constructor for transcoding J2K images from JavaScript.
+  /// </summary>
+  J2KTranscoder() {
+  }
+
+  /// <summary>
+  /// Decodes the bitstream in decoder's encoded buffer to the requested
+  /// decomposition level and layer (0 = all layers) and encodes the result
+  /// with the settings of encoder (decompositions, quality, progression
+  /// order, etc).  The new bitstream is available from the encoder's
+  /// encoded buffer and the source image properties from the decoder's
+  /// getters.  Returns false if decoding or encoding failed.
+  /// </summary>
+  bool transcode(J2KDecoder& decoder, J2KEncoder& encoder, size_t decompositionLevel, size_t decodeLayer) {
+    opj_image_t* image = decoder.decodeToImage(decompositionLevel, decodeLayer);
+    if(!image) {
+      return false;
+    }
+
+    // a sub resolution decode leaves the reference grid at full resolution,
+    // move it to the decoded resolution so it matches the component sizes
+    for(OPJ_UINT32 compno = 0; compno < image->numcomps; compno++) {
+      image->comps[compno].factor = 0;
+    }
+    image->x0 = image->comps[0].x0 * image->comps[0].dx;
+    image->y0 = image->comps[0].y0 * image->comps[0].dy;
+    image->x1 = image->x0 + image->comps[0].w * image->comps[0].dx;
+    image->y1 = image->y0 + image->comps[0].h * image->comps[0].dy;
+
+    const bool result = encoder.encodeImage(image);
+    opj_image_destroy(image);
+    return result;
+  }
+};
@@ -0,0 +1,33 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>
+/// Sample statistics of one component, computed while the decoder converts
+/// samples (see J2KDecoder::setStatistics())
+/// </summary>
+struct Statistics {
+    /// <summary>
+    /// Smallest sample value
+    /// </summary>
+    int32_t minimum;
+
+    /// <summary>
+    /// Largest sample value
+    /// </summary>
+    int32_t maximum;
+
+    /// <summary>
+    /// Sample value at the start of the first histogram bin, the histogram
+    /// spans the range of bitsPerSample (e.g. -32768 for signed 16 bit)
+    /// </summary>
+    int32_t histogramOffset;
+
+    /// <summary>
+    /// Number of sample values in each histogram bin
+    /// </summary>
+    double histogramBinWidth;
+};
@@ -2,14 +2,35 @@
 // SPDX-License-Identifier: MIT
 
 
+// OPENJPEGJS_DECODER_ONLY builds the decoder-only module (openjpegjs-decoder)
+// without J2KEncoder/J2KTranscoder so the openjp2 encoder is not linked in.
+// OPENJPEGJS_MEMORY_STATS builds the memory benchmark module
+// (openjpegjs-memory) that counts every allocation, see getMemoryStats()
+
 #include "J2KDecoder.hpp"
+#ifndef OPENJPEGJS_DECODER_ONLY
 #include "J2KEncoder.hpp"
+#include "J2KTranscoder.hpp"
+#include "J2KEncodePreset.hpp"
+#endif
+#include "DecodeLimits.hpp"
+#include "DecodeOptions.hpp"
+#include "DecodeResult.hpp"
+#include "Diagnostics.hpp"
+#include "Estimate.hpp"
 #include "FrameInfo.hpp"
+#include "J2KStatus.hpp"
 #include "Point.hpp"
 #include "Size.hpp"
+#include "Statistics.hpp"
 
 #include <emscripten.h>
 #include <emscripten/bind.h>
+#ifdef OPENJPEGJS_MEMORY_STATS
+#include <emscripten/emmalloc.h>
+#include <emscripten/heap.h>
+#include <errno.h>
+#endif
 
 using namespace emscripten;
 
@@ -18,6 +39,118 @@ static std::string getVersion() {
   return version;
 }
 
+#ifdef OPENJPEGJS_MEMORY_STATS
+// current size of the WASM heap, it only grows so after an operation it
+// is the peak for the module so far
+static size_t getHeapSize() {
+  return emscripten_get_heap_size();
+}
+
+// Heap use since resetMemoryStats(): the peak bytes in use above what was
+// live at the reset, and the number and total bytes of allocations
+struct MemoryStats {
+  size_t peakBytes;
+  size_t allocations;
+  size_t allocatedBytes;
+};
+
+// emmalloc defines the malloc family as weak aliases of its emmalloc_*
+// functions, these counting versions take their place (the module is
+// single threaded) so openjp2's allocations are counted too
+static size_t liveBytes = 0;
+static size_t baseBytes = 0;
+static size_t peakBytes = 0;
+static size_t allocations = 0;
+static size_t allocatedBytes = 0;
+
+static void* trackAllocation(void* ptr) {
+  if(ptr) {
+    const size_t size = emmalloc_usable_size(ptr);
+    allocations++;
+    allocatedBytes += size;
+    liveBytes += size;
+    peakBytes = std::max(peakBytes, liveBytes);
+  }
+  return ptr;
+}
+
+static void untrackAllocation(void* ptr) {
+  if(ptr) {
+    liveBytes -= emmalloc_usable_size(ptr);
+  }
+}
+
+extern "C" {
+void* malloc(size_t size) {
+  return trackAllocation(emmalloc_malloc(size));
+}
+
+void* calloc(size_t count, size_t size) {
+  return trackAllocation(emmalloc_calloc(count, size));
+}
+
+void* realloc(void* ptr, size_t size) {
+  const size_t previous = ptr ? emmalloc_usable_size(ptr) : 0;
+  void* result = emmalloc_realloc(ptr, size);
+  if(!result && size) {
+    return NULL; // the original block is still allocated
+  }
+  liveBytes -= previous;
+  return trackAllocation(result);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  return trackAllocation(emmalloc_memalign(alignment, size));
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  return trackAllocation(emmalloc_memalign(alignment, size));
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+  void* result = trackAllocation(emmalloc_memalign(alignment, size));
+  if(!result) {
+    return ENOMEM;
+  }
+  *ptr = result;
+  return 0;
+}
+
+void free(void* ptr) {
+  untrackAllocation(ptr);
+  emmalloc_free(ptr);
+}
+}
+
+// starts measuring an operation, see getMemoryStats()
+static void resetMemoryStats() {
+  baseBytes = liveBytes;
+  peakBytes = liveBytes;
+  allocations = 0;
+  allocatedBytes = 0;
+}
+
+static MemoryStats getMemoryStats() {
+  MemoryStats stats;
+  stats.peakBytes = peakBytes - baseBytes;
+  stats.allocations = allocations;
+  stats.allocatedBytes = allocatedBytes;
+  return stats;
+}
+
+EMSCRIPTEN_BINDINGS(MemoryStats) {
+  function("getHeapSize", &getHeapSize);
+  function("resetMemoryStats", &resetMemoryStats);
+  function("getMemoryStats", &getMemoryStats);
+
+  value_object<MemoryStats>("MemoryStats")
+    .field("peakBytes", &MemoryStats::peakBytes)
+    .field("allocations", &MemoryStats::allocations)
+    .field("allocatedBytes", &MemoryStats::allocatedBytes)
+       ;
+}
+#endif
+
 EMSCRIPTEN_BINDINGS(charlsjs) {
     function("getVersion", &getVersion);
 }
@@ -31,6 +164,101 @@ EMSCRIPTEN_BINDINGS(FrameInfo) {
        ;
 }
 
+EMSCRIPTEN_BINDINGS(DecodeLimits) {
+  value_object<DecodeLimits>("DecodeLimits")
+    .field("maxPixels", &DecodeLimits::maxPixels)
+    .field("maxComponents", &DecodeLimits::maxComponents)
+    .field("maxTiles", &DecodeLimits::maxTiles)
+    .field("maxMemory", &DecodeLimits::maxMemory)
+    .field("maxDecodeTime", &DecodeLimits::maxDecodeTime)
+    .field("maxCodeBlocks", &DecodeLimits::maxCodeBlocks)
+       ;
+}
+
+EMSCRIPTEN_BINDINGS(DecodeOptions) {
+  value_object<DecodeOptions>("DecodeOptions")
+    .field("decompositionLevel", &DecodeOptions::decompositionLevel)
+    .field("decodeLayer", &DecodeOptions::decodeLayer)
+       ;
+}
+
+EMSCRIPTEN_BINDINGS(DecodeResult) {
+  value_object<DecodeResult>("DecodeResult")
+    .field("status", &DecodeResult::status)
+    .field("frameInfo", &DecodeResult::frameInfo)
+    .field("numDecompositions", &DecodeResult::numDecompositions)
+    .field("isReversible", &DecodeResult::isReversible)
+    .field("isHighThroughput", &DecodeResult::isHighThroughput)
+    .field("progressionOrder", &DecodeResult::progressionOrder)
+    .field("imageOffset", &DecodeResult::imageOffset)
+    .field("tileSize", &DecodeResult::tileSize)
+    .field("tileOffset", &DecodeResult::tileOffset)
+    .field("blockDimensions", &DecodeResult::blockDimensions)
+    .field("numLayers", &DecodeResult::numLayers)
+    .field("colorSpace", &DecodeResult::colorSpace)
+    .field("pixelData", &DecodeResult::pixelData)
+       ;
+}
+
+EMSCRIPTEN_BINDINGS(Diagnostic) {
+  value_object<Diagnostic>("Diagnostic")
+    .field("level", &Diagnostic::level)
+    .field("code", &Diagnostic::code)
+    .field("message", &Diagnostic::message)
+       ;
+}
+
+EMSCRIPTEN_BINDINGS(DiagnosticLevel) {
+  enum_<DiagnosticLevel>("DiagnosticLevel")
+    .value("Error", DiagnosticLevel::Error)
+    .value("Warning", DiagnosticLevel::Warning)
+    .value("Info", DiagnosticLevel::Info)
+       ;
+}
+
+EMSCRIPTEN_BINDINGS(DiagnosticCode) {
+  enum_<DiagnosticCode>("DiagnosticCode")
+    .value("OpenJPEG", DiagnosticCode::OpenJPEG)
+    .value("SetupFailed", DiagnosticCode::SetupFailed)
+    .value("HeaderFailed", DiagnosticCode::HeaderFailed)
+    .value("DecodeFailed", DiagnosticCode::DecodeFailed)
+    .value("EncodeFailed", DiagnosticCode::EncodeFailed)
+    .value("LimitExceeded", DiagnosticCode::LimitExceeded)
+    .value("Unsupported", DiagnosticCode::Unsupported)
+    .value("ReadFailed", DiagnosticCode::ReadFailed)
+       ;
+}
+
+EMSCRIPTEN_BINDINGS(Estimate) {
+  value_object<Estimate>("Estimate")
+    .field("encodedBytes", &Estimate::encodedBytes)
+    .field("imageBytes", &Estimate::imageBytes)
+    .field("workspaceBytes", &Estimate::workspaceBytes)
+    .field("decodedBytes", &Estimate::decodedBytes)
+    .field("totalBytes", &Estimate::totalBytes)
+    .field("cost", &Estimate::cost)
+       ;
+}
+
+EMSCRIPTEN_BINDINGS(J2KStatus) {
+  enum_<J2KStatus>("J2KStatus")
+    .value("Ok", J2KStatus::Ok)
+    .value("Failed", J2KStatus::Failed)
+    .value("Cancelled", J2KStatus::Cancelled)
+    .value("LimitExceeded", J2KStatus::LimitExceeded)
+       ;
+}
+
+#ifndef OPENJPEGJS_DECODER_ONLY
+EMSCRIPTEN_BINDINGS(J2KEncodePreset) {
+  enum_<J2KEncodePreset>("J2KEncodePreset")
+    .value("FastestLossless", J2KEncodePreset::FastestLossless)
+    .value("Balanced", J2KEncodePreset::Balanced)
+    .value("Smallest", J2KEncodePreset::Smallest)
+       ;
+}
+#endif
+
 EMSCRIPTEN_BINDINGS(Point) {
   value_object<Point>("Point")
     .field("x", &Point::x)
@@ -45,6 +273,15 @@ EMSCRIPTEN_BINDINGS(Size) {
        ;
 }
 
+EMSCRIPTEN_BINDINGS(Statistics) {
+  value_object<Statistics>("Statistics")
+    .field("minimum", &Statistics::minimum)
+    .field("maximum", &Statistics::maximum)
+    .field("histogramOffset", &Statistics::histogramOffset)
+    .field("histogramBinWidth", &Statistics::histogramBinWidth)
+       ;
+}
+
 EMSCRIPTEN_BINDINGS(J2KDecoder) {
   class_<J2KDecoder>("J2KDecoder")
     .constructor<>()
@@ -52,28 +289,61 @@ EMSCRIPTEN_BINDINGS(J2KDecoder) {
     .function("getDecodedBuffer", &J2KDecoder::getDecodedBuffer)
     .function("readHeader", &J2KDecoder::readHeader)
     .function("calculateSizeAtDecompositionLevel", &J2KDecoder::calculateSizeAtDecompositionLevel)
+    .function("estimateDecode", &J2KDecoder::estimateDecode)
     .function("decode", &J2KDecoder::decode)
+    .function("decodeFrame", &J2KDecoder::decodeFrame)
     .function("decodeSubResolution", &J2KDecoder::decodeSubResolution)
+    .function("decodeWithinBudget", &J2KDecoder::decodeWithinBudget)
+    .function("decodeSlice", &J2KDecoder::decodeSlice)
+    .function("decodeBands", &J2KDecoder::decodeBands)
+    .function("beginProgressiveDecode", &J2KDecoder::beginProgressiveDecode)
+    .function("decodeProgressive", &J2KDecoder::decodeProgressive)
+    .function("endProgressiveDecode", &J2KDecoder::endProgressiveDecode)
+    .function("decodePyramid", &J2KDecoder::decodePyramid)
+    .function("getPyramidBuffer", &J2KDecoder::getPyramidBuffer)
+    .function("getPyramidFrameInfo", &J2KDecoder::getPyramidFrameInfo)
     .function("getFrameInfo", &J2KDecoder::getFrameInfo)
     .function("getNumDecompositions", &J2KDecoder::getNumDecompositions)
     .function("getIsReversible", &J2KDecoder::getIsReversible)
+    .function("getIsHighThroughput", &J2KDecoder::getIsHighThroughput)
     .function("getProgressionOrder", &J2KDecoder::getProgressionOrder)
     .function("getImageOffset", &J2KDecoder::getImageOffset)
     .function("getTileSize", &J2KDecoder::getTileSize)
     .function("getTileOffset", &J2KDecoder::getTileOffset)
     .function("getBlockDimensions", &J2KDecoder::getBlockDimensions)
     .function("getNumLayers", &J2KDecoder::getNumLayers)
+    .function("getLayersDecoded", &J2KDecoder::getLayersDecoded)
     .function("getColorSpace", &J2KDecoder::getColorSpace)
+    .function("getNumSlices", &J2KDecoder::getNumSlices)
+    .function("getDecodeResult", &J2KDecoder::getDecodeResult)
+    .function("cancel", &J2KDecoder::cancel)
+    .function("setTimeLimit", &J2KDecoder::setTimeLimit)
+    .function("getStatus", &J2KDecoder::getStatus)
+    .function("setVerbosity", &J2KDecoder::setVerbosity)
+    .function("getNumDiagnostics", &J2KDecoder::getNumDiagnostics)
+    .function("getDiagnostic", &J2KDecoder::getDiagnostic)
+    .function("getNumErrors", &J2KDecoder::getNumErrors)
+    .function("getNumWarnings", &J2KDecoder::getNumWarnings)
+    .function("setStatistics", &J2KDecoder::setStatistics)
+    .function("getStatistics", &J2KDecoder::getStatistics)
+    .function("setLimits", &J2KDecoder::setLimits)
+    .function("getLimits", &J2KDecoder::getLimits)
+    .function("getHistogramBuffer", &J2KDecoder::getHistogramBuffer)
+    .function("setConvertToRGB", &J2KDecoder::setConvertToRGB)
    ;
 }
 
 
+#ifndef OPENJPEGJS_DECODER_ONLY
 EMSCRIPTEN_BINDINGS(J2KEncoder) {
   class_<J2KEncoder>("J2KEncoder")
     .constructor<>()
     .function("getDecodedBuffer", &J2KEncoder::getDecodedBuffer)
     .function("getEncodedBuffer", &J2KEncoder::getEncodedBuffer)
     .function("encode", &J2KEncoder::encode)
+    .function("encodeVolume", &J2KEncoder::encodeVolume)
+    .function("encodeFrame", &J2KEncoder::encodeFrame)
+    .function("estimateEncode", &J2KEncoder::estimateEncode)
     .function("setDecompositions", &J2KEncoder::setDecompositions)
     .function("setQuality", &J2KEncoder::setQuality)
     .function("setProgressionOrder", &J2KEncoder::setProgressionOrder)
@@ -82,9 +352,33 @@ EMSCRIPTEN_BINDINGS(J2KEncoder) {
     .function("setTileSize", &J2KEncoder::setTileSize)
     .function("setTileOffset", &J2KEncoder::setTileOffset)
     .function("setBlockDimensions", &J2KEncoder::setBlockDimensions)
+    .function("setCodeBlockStyle", &J2KEncoder::setCodeBlockStyle)
+    .function("setPreset", &J2KEncoder::setPreset)
     .function("setNumPrecincts", &J2KEncoder::setNumPrecincts)
     .function("setPrecinct", &J2KEncoder::setPrecinct)
     .function("setCompressionRatio", &J2KEncoder::setCompressionRatio)
+    .function("setTargetSize", &J2KEncoder::setTargetSize)
+    .function("setTargetPSNR", &J2KEncoder::setTargetPSNR)
+    .function("setMeasurePSNR", &J2KEncoder::setMeasurePSNR)
+    .function("getPSNR", &J2KEncoder::getPSNR)
+    .function("setAutoBitDepth", &J2KEncoder::setAutoBitDepth)
+    .function("getEncodedBitsPerSample", &J2KEncoder::getEncodedBitsPerSample)
+    .function("cancel", &J2KEncoder::cancel)
+    .function("setTimeLimit", &J2KEncoder::setTimeLimit)
+    .function("getStatus", &J2KEncoder::getStatus)
+    .function("setVerbosity", &J2KEncoder::setVerbosity)
+    .function("getNumDiagnostics", &J2KEncoder::getNumDiagnostics)
+    .function("getDiagnostic", &J2KEncoder::getDiagnostic)
+    .function("getNumErrors", &J2KEncoder::getNumErrors)
+    .function("getNumWarnings", &J2KEncoder::getNumWarnings)
     
    ;
 }
+
+EMSCRIPTEN_BINDINGS(J2KTranscoder) {
+  class_<J2KTranscoder>("J2KTranscoder")
+    .constructor<>()
+    .function("transcode", &J2KTranscoder::transcode)
+   ;
+}
+#endif
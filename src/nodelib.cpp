@@ -0,0 +1,914 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Native Node.js (N-API) addon exposing the same J2KDecoder/J2KEncoder API
+// as jslib.cpp so Node code can switch between the WASM build and the native
+// build without changes.  Unlike the typed_memory_view() results in the
+// WASM build, Buffers never point into memory owned by the decoder/encoder,
+// which the next decode/encode or delete() would free under JavaScript:
+// results (decoded pixels, encoded bitstream) are copied, and the input
+// buffers returned by getEncodedBuffer()/getDecodedBuffer() are allocated
+// by JavaScript and kept alive by the decoder/encoder that reads them.
+
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+#include <node_api.h>
+
+#include "J2KDecoder.hpp"
+#include "J2KEncoder.hpp"
+#include "J2KTranscoder.hpp"
+#include "DecodeLimits.hpp"
+#include "DecodeOptions.hpp"
+#include "DecodeResult.hpp"
+#include "Diagnostics.hpp"
+#include "Estimate.hpp"
+#include "FrameInfo.hpp"
+#include "Point.hpp"
+#include "Size.hpp"
+#include "Statistics.hpp"
+
+#define NAPI_CALL(env, call)                                    \
+  do {                                                          \
+    if ((call) != napi_ok) {                                    \
+      napi_throw_error((env), NULL, "openjpegjs: " #call " failed"); \
+      return NULL;                                              \
+    }                                                           \
+  } while (0)
+
+namespace {
+
+// Conversion of arguments and return values between JavaScript and C++
+
+template <typename T, typename Enable = void>
+struct Js;
+
+template <typename T>
+struct Js<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+  static T from(napi_env env, napi_value value) {
+    int64_t result = 0;
+    napi_get_value_int64(env, value, &result);
+    return (T)result;
+  }
+  static napi_value to(napi_env env, T value) {
+    napi_value result;
+    napi_create_int64(env, (int64_t)value, &result);
+    return result;
+  }
+};
+
+template <typename T>
+struct Js<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+  static T from(napi_env env, napi_value value) {
+    double result = 0;
+    napi_get_value_double(env, value, &result);
+    return (T)result;
+  }
+  static napi_value to(napi_env env, T value) {
+    napi_value result;
+    napi_create_double(env, (double)value, &result);
+    return result;
+  }
+};
+
+// enums are plain numbers, see the J2KStatus export below
+template <typename T>
+struct Js<T, typename std::enable_if<std::is_enum<T>::value>::type> {
+  static T from(napi_env env, napi_value value) {
+    return (T)Js<int32_t>::from(env, value);
+  }
+  static napi_value to(napi_env env, T value) {
+    return Js<int32_t>::to(env, (int32_t)value);
+  }
+};
+
+template <>
+struct Js<bool> {
+  static bool from(napi_env env, napi_value value) {
+    bool result = false;
+    napi_coerce_to_bool(env, value, &value);
+    napi_get_value_bool(env, value, &result);
+    return result;
+  }
+  static napi_value to(napi_env env, bool value) {
+    napi_value result;
+    napi_get_boolean(env, value, &result);
+    return result;
+  }
+};
+
+template <>
+struct Js<std::string> {
+  static napi_value to(napi_env env, const std::string& value) {
+    napi_value result;
+    napi_create_string_utf8(env, value.data(), value.size(), &result);
+    return result;
+  }
+};
+
+template <typename T>
+T getField(napi_env env, napi_value object, const char* name) {
+  napi_value value;
+  napi_get_named_property(env, object, name, &value);
+  return Js<T>::from(env, value);
+}
+
+template <typename T>
+void setField(napi_env env, napi_value object, const char* name, T value) {
+  napi_set_named_property(env, object, name, Js<T>::to(env, value));
+}
+
+template <>
+struct Js<Point> {
+  static Point from(napi_env env, napi_value value) {
+    return Point(getField<uint32_t>(env, value, "x"), getField<uint32_t>(env, value, "y"));
+  }
+  static napi_value to(napi_env env, const Point& value) {
+    napi_value result;
+    napi_create_object(env, &result);
+    setField(env, result, "x", value.x);
+    setField(env, result, "y", value.y);
+    return result;
+  }
+};
+
+template <>
+struct Js<Size> {
+  static Size from(napi_env env, napi_value value) {
+    return Size(getField<uint32_t>(env, value, "width"), getField<uint32_t>(env, value, "height"));
+  }
+  static napi_value to(napi_env env, const Size& value) {
+    napi_value result;
+    napi_create_object(env, &result);
+    setField(env, result, "width", value.width);
+    setField(env, result, "height", value.height);
+    return result;
+  }
+};
+
+template <>
+struct Js<FrameInfo> {
+  static FrameInfo from(napi_env env, napi_value value) {
+    FrameInfo frameInfo;
+    frameInfo.width = getField<uint32_t>(env, value, "width");
+    frameInfo.height = getField<uint32_t>(env, value, "height");
+    frameInfo.bitsPerSample = getField<uint8_t>(env, value, "bitsPerSample");
+    frameInfo.componentCount = getField<uint8_t>(env, value, "componentCount");
+    frameInfo.isSigned = getField<bool>(env, value, "isSigned");
+    return frameInfo;
+  }
+  static napi_value to(napi_env env, const FrameInfo& value) {
+    napi_value result;
+    napi_create_object(env, &result);
+    setField(env, result, "width", value.width);
+    setField(env, result, "height", value.height);
+    setField(env, result, "bitsPerSample", value.bitsPerSample);
+    setField(env, result, "componentCount", value.componentCount);
+    setField(env, result, "isSigned", value.isSigned);
+    return result;
+  }
+};
+
+template <>
+struct Js<DecodeLimits> {
+  static DecodeLimits from(napi_env env, napi_value value) {
+    DecodeLimits limits;
+    limits.maxPixels = getField<size_t>(env, value, "maxPixels");
+    limits.maxComponents = getField<size_t>(env, value, "maxComponents");
+    limits.maxTiles = getField<size_t>(env, value, "maxTiles");
+    limits.maxMemory = getField<size_t>(env, value, "maxMemory");
+    limits.maxDecodeTime = getField<double>(env, value, "maxDecodeTime");
+    limits.maxCodeBlocks = getField<size_t>(env, value, "maxCodeBlocks");
+    return limits;
+  }
+  static napi_value to(napi_env env, const DecodeLimits& value) {
+    napi_value result;
+    napi_create_object(env, &result);
+    setField(env, result, "maxPixels", value.maxPixels);
+    setField(env, result, "maxComponents", value.maxComponents);
+    setField(env, result, "maxTiles", value.maxTiles);
+    setField(env, result, "maxMemory", value.maxMemory);
+    setField(env, result, "maxDecodeTime", value.maxDecodeTime);
+    setField(env, result, "maxCodeBlocks", value.maxCodeBlocks);
+    return result;
+  }
+};
+
+template <>
+struct Js<DecodeOptions> {
+  static DecodeOptions from(napi_env env, napi_value value) {
+    DecodeOptions options;
+    options.decompositionLevel = getField<size_t>(env, value, "decompositionLevel");
+    options.decodeLayer = getField<size_t>(env, value, "decodeLayer");
+    return options;
+  }
+};
+
+template <>
+struct Js<DecodeResult> {
+  static napi_value to(napi_env env, const DecodeResult& value) {
+    napi_value result;
+    napi_create_object(env, &result);
+    setField(env, result, "status", value.status);
+    setField(env, result, "frameInfo", value.frameInfo);
+    setField(env, result, "numDecompositions", value.numDecompositions);
+    setField(env, result, "isReversible", value.isReversible);
+    setField(env, result, "isHighThroughput", value.isHighThroughput);
+    setField(env, result, "progressionOrder", value.progressionOrder);
+    setField(env, result, "imageOffset", value.imageOffset);
+    setField(env, result, "tileSize", value.tileSize);
+    setField(env, result, "tileOffset", value.tileOffset);
+    setField(env, result, "blockDimensions", value.blockDimensions);
+    setField(env, result, "numLayers", value.numLayers);
+    setField(env, result, "colorSpace", value.colorSpace);
+    return result;
+  }
+};
+
+template <>
+struct Js<Diagnostic> {
+  static napi_value to(napi_env env, const Diagnostic& value) {
+    napi_value result;
+    napi_create_object(env, &result);
+    setField(env, result, "level", value.level);
+    setField(env, result, "code", value.code);
+    setField(env, result, "message", value.message);
+    return result;
+  }
+};
+
+template <>
+struct Js<Estimate> {
+  static napi_value to(napi_env env, const Estimate& value) {
+    napi_value result;
+    napi_create_object(env, &result);
+    setField(env, result, "encodedBytes", value.encodedBytes);
+    setField(env, result, "imageBytes", value.imageBytes);
+    setField(env, result, "workspaceBytes", value.workspaceBytes);
+    setField(env, result, "decodedBytes", value.decodedBytes);
+    setField(env, result, "totalBytes", value.totalBytes);
+    setField(env, result, "cost", value.cost);
+    return result;
+  }
+};
+
+template <>
+struct Js<Statistics> {
+  static napi_value to(napi_env env, const Statistics& value) {
+    napi_value result;
+    napi_create_object(env, &result);
+    setField(env, result, "minimum", value.minimum);
+    setField(env, result, "maximum", value.maximum);
+    setField(env, result, "histogramOffset", value.histogramOffset);
+    setField(env, result, "histogramBinWidth", value.histogramBinWidth);
+    return result;
+  }
+};
+
+template <typename T>
+using Plain = typename std::remove_cv<typename std::remove_reference<T>::type>::type;
+
+// Wrapped instances.  The codec object is allocated separately so delete()
+// can release it before the JavaScript object is garbage collected.
+
+void initialize(J2KDecoder* decoder) {
+  decoder->setNumThreads(opj_get_num_cpus());
+}
+
+void initialize(J2KEncoder* encoder) {
+  encoder->setNumThreads(opj_get_num_cpus());
+}
+
+void initialize(J2KTranscoder*) {
+}
+
+// Type tags so an object of one class passed where another is expected
+// (e.g. transcode(encoder, decoder)) is rejected instead of misused
+template <typename Codec>
+const napi_type_tag* typeTag();
+
+template <>
+const napi_type_tag* typeTag<J2KDecoder>() {
+  static const napi_type_tag tag = { 0x4a324b4465636f64ULL, 0x65724f70656e4a50ULL };
+  return &tag;
+}
+
+template <>
+const napi_type_tag* typeTag<J2KEncoder>() {
+  static const napi_type_tag tag = { 0x4a324b456e636f64ULL, 0x65724f70656e4a50ULL };
+  return &tag;
+}
+
+template <>
+const napi_type_tag* typeTag<J2KTranscoder>() {
+  static const napi_type_tag tag = { 0x4a324b5472616e73ULL, 0x636f6465724f704aULL };
+  return &tag;
+}
+
+template <typename Codec>
+struct Wrapper {
+  Wrapper() : codec(new Codec()), pinned(NULL) {
+    initialize(codec);
+  }
+
+  ~Wrapper() {
+    delete codec;
+  }
+
+  Codec* codec;
+  // Reference to the JavaScript memory the codec reads from (passed to
+  // setEncodedBuffer()/setDecodedBuffer() or returned by getEncodedBuffer()/
+  // getDecodedBuffer()) which must be kept alive while the codec uses it
+  napi_ref pinned;
+};
+
+template <typename Codec>
+void finalize(napi_env env, void* data, void* hint) {
+  (void)hint;
+  Wrapper<Codec>* wrapper = (Wrapper<Codec>*)data;
+  if(wrapper->pinned) {
+    napi_delete_reference(env, wrapper->pinned);
+  }
+  delete wrapper;
+}
+
+template <typename Codec>
+Wrapper<Codec>* unwrap(napi_env env, napi_value object) {
+  bool isType = false;
+  void* data = NULL;
+  if(napi_check_object_type_tag(env, object, typeTag<Codec>(), &isType) != napi_ok || !isType ||
+      napi_unwrap(env, object, &data) != napi_ok) {
+    napi_throw_type_error(env, NULL, "openjpegjs: unexpected object type");
+    return NULL;
+  }
+  Wrapper<Codec>* wrapper = (Wrapper<Codec>*)data;
+  if(wrapper->codec == NULL) {
+    napi_throw_error(env, NULL, "openjpegjs: object has been deleted");
+    return NULL;
+  }
+  return wrapper;
+}
+
+template <typename Codec>
+Wrapper<Codec>* unwrap(napi_env env, napi_callback_info info, size_t& argc, napi_value* argv) {
+  napi_value self;
+  if(napi_get_cb_info(env, info, &argc, argv, &self, NULL) != napi_ok) {
+    napi_throw_error(env, NULL, "openjpegjs: invalid this");
+    return NULL;
+  }
+  return unwrap<Codec>(env, self);
+}
+
+template <typename Codec>
+void pin(napi_env env, Wrapper<Codec>* wrapper, napi_value value) {
+  if(wrapper->pinned) {
+    napi_delete_reference(env, wrapper->pinned);
+    wrapper->pinned = NULL;
+  }
+  if(value) {
+    napi_create_reference(env, value, 1, &wrapper->pinned);
+  }
+}
+
+template <typename Codec>
+napi_value constructor(napi_env env, napi_callback_info info) {
+  napi_value self;
+  NAPI_CALL(env, napi_get_cb_info(env, info, NULL, NULL, &self, NULL));
+  Wrapper<Codec>* wrapper = new Wrapper<Codec>();
+  if(napi_wrap(env, self, wrapper, finalize<Codec>, NULL, NULL) != napi_ok ||
+      napi_type_tag_object(env, self, typeTag<Codec>()) != napi_ok) {
+    delete wrapper;
+    napi_throw_error(env, NULL, "openjpegjs: napi_wrap failed");
+    return NULL;
+  }
+  return self;
+}
+
+// embind compatible delete() - frees the native codec immediately
+template <typename Codec>
+napi_value destroy(napi_env env, napi_callback_info info) {
+  size_t argc = 0;
+  Wrapper<Codec>* wrapper = unwrap<Codec>(env, info, argc, NULL);
+  if(!wrapper) {
+    return NULL;
+  }
+  pin<Codec>(env, wrapper, NULL);
+  delete wrapper->codec;
+  wrapper->codec = NULL;
+  return NULL;
+}
+
+// Generic binding of a member function, converting each argument and the
+// return value with Js<>
+
+template <typename M>
+struct Method;
+
+template <typename C, typename R, typename... Args>
+struct Method<R (C::*)(Args...)> {
+  typedef C Class;
+  typedef R Result;
+  typedef std::tuple<Plain<Args>...> Arguments;
+};
+
+template <typename C, typename R, typename... Args>
+struct Method<R (C::*)(Args...) const> : Method<R (C::*)(Args...)> {};
+
+template <auto M, typename C, std::size_t... I>
+napi_value invoke(napi_env env, C* codec, napi_value* argv, std::index_sequence<I...>) {
+  typedef typename Method<decltype(M)>::Arguments Arguments;
+  typedef Plain<typename Method<decltype(M)>::Result> Result;
+  if constexpr (std::is_void<Result>::value) {
+    (codec->*M)(Js<typename std::tuple_element<I, Arguments>::type>::from(env, argv[I])...);
+    return NULL;
+  } else {
+    return Js<Result>::to(env, (codec->*M)(Js<typename std::tuple_element<I, Arguments>::type>::from(env, argv[I])...));
+  }
+}
+
+template <auto M>
+napi_value method(napi_env env, napi_callback_info info) {
+  typedef typename Method<decltype(M)>::Class Codec;
+  constexpr size_t arity = std::tuple_size<typename Method<decltype(M)>::Arguments>::value;
+  size_t argc = arity;
+  napi_value argv[arity > 0 ? arity : 1];
+  Wrapper<Codec>* wrapper = unwrap<Codec>(env, info, argc, argv);
+  if(!wrapper) {
+    return NULL;
+  }
+  if(argc < arity) {
+    napi_throw_type_error(env, NULL, "openjpegjs: missing arguments");
+    return NULL;
+  }
+  return invoke<M>(env, wrapper->codec, argv, std::make_index_sequence<arity>());
+}
+
+// Returns a Buffer holding a copy of size bytes at data
+napi_value copyBuffer(napi_env env, const uint8_t* data, size_t size) {
+  napi_value result;
+  NAPI_CALL(env, napi_create_buffer_copy(env, size, size ? data : NULL, NULL, &result));
+  return result;
+}
+
+// Returns a new Buffer of size bytes for the codec to read from, pinned so
+// it lives as long as the codec uses it
+template <typename Codec>
+napi_value inputBuffer(napi_env env, Wrapper<Codec>* wrapper, size_t size, uint8_t*& data) {
+  napi_value result;
+  void* base = NULL;
+  NAPI_CALL(env, napi_create_buffer(env, size, &base, &result));
+  pin<Codec>(env, wrapper, result);
+  data = (uint8_t*)base;
+  return result;
+}
+
+// Returns the data pointer and length of a Buffer, TypedArray or ArrayBuffer
+bool getBytes(napi_env env, napi_value value, uint8_t*& data, size_t& size) {
+  bool is = false;
+  if(napi_is_typedarray(env, value, &is) == napi_ok && is) {
+    napi_typedarray_type type;
+    size_t length, offset;
+    napi_value arrayBuffer;
+    void* base;
+    if(napi_get_typedarray_info(env, value, &type, &length, &base, &arrayBuffer, &offset) != napi_ok) {
+      return false;
+    }
+    napi_value bytesPerElement;
+    napi_get_named_property(env, value, "BYTES_PER_ELEMENT", &bytesPerElement);
+    data = (uint8_t*)base;
+    size = length * Js<size_t>::from(env, bytesPerElement);
+    return true;
+  }
+  if(napi_is_arraybuffer(env, value, &is) == napi_ok && is) {
+    void* base;
+    if(napi_get_arraybuffer_info(env, value, &base, &size) != napi_ok) {
+      return false;
+    }
+    data = (uint8_t*)base;
+    return true;
+  }
+  return false;
+}
+
+// J2KDecoder
+
+napi_value decoderGetEncodedBuffer(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  Wrapper<J2KDecoder>* wrapper = unwrap<J2KDecoder>(env, info, argc, argv);
+  if(!wrapper) {
+    return NULL;
+  }
+  const size_t size = Js<size_t>::from(env, argv[0]);
+  uint8_t* data = NULL;
+  napi_value result = inputBuffer<J2KDecoder>(env, wrapper, size, data);
+  if(result) {
+    wrapper->codec->setEncodedBytes(data, size);
+  }
+  return result;
+}
+
+// Zero copy alternative to getEncodedBuffer() - decodes directly from the
+// passed Buffer which is kept alive until the next call
+napi_value decoderSetEncodedBuffer(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  Wrapper<J2KDecoder>* wrapper = unwrap<J2KDecoder>(env, info, argc, argv);
+  if(!wrapper) {
+    return NULL;
+  }
+  uint8_t* data;
+  size_t size;
+  if(argc < 1 || !getBytes(env, argv[0], data, size)) {
+    napi_throw_type_error(env, NULL, "openjpegjs: expected a Buffer or TypedArray");
+    return NULL;
+  }
+  pin<J2KDecoder>(env, wrapper, argv[0]);
+  wrapper->codec->setEncodedBytes(data, size);
+  return NULL;
+}
+
+// One call alternative to setEncodedBuffer(), decodeSubResolution() and the
+// getters like decodeFrame() in the WASM build, decodes directly from the
+// passed Buffer and returns the DecodeResult with a copy of the pixel data
+napi_value decoderDecodeFrame(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  Wrapper<J2KDecoder>* wrapper = unwrap<J2KDecoder>(env, info, argc, argv);
+  if(!wrapper) {
+    return NULL;
+  }
+  uint8_t* data;
+  size_t size;
+  if(argc < 1 || !getBytes(env, argv[0], data, size)) {
+    napi_throw_type_error(env, NULL, "openjpegjs: expected a Buffer or TypedArray");
+    return NULL;
+  }
+  napi_valuetype type = napi_undefined;
+  if(argc > 1) {
+    napi_typeof(env, argv[1], &type);
+  }
+  const DecodeOptions options = type == napi_object ? Js<DecodeOptions>::from(env, argv[1]) : DecodeOptions();
+  pin<J2KDecoder>(env, wrapper, argv[0]);
+  J2KDecoder* decoder = wrapper->codec;
+  decoder->setEncodedBytes(data, size);
+  decoder->decodeSubResolution(options.decompositionLevel, options.decodeLayer);
+  napi_value result = Js<DecodeResult>::to(env, decoder->getDecodeResult());
+  const std::vector<uint8_t>& decoded = decoder->getDecodedBytes();
+  napi_value pixelData = copyBuffer(env, decoded.data(), decoded.size());
+  if(!pixelData) {
+    return NULL;
+  }
+  NAPI_CALL(env, napi_set_named_property(env, result, "pixelData", pixelData));
+  return result;
+}
+
+napi_value decoderGetDecodedBuffer(napi_env env, napi_callback_info info) {
+  size_t argc = 0;
+  Wrapper<J2KDecoder>* wrapper = unwrap<J2KDecoder>(env, info, argc, NULL);
+  if(!wrapper) {
+    return NULL;
+  }
+  const std::vector<uint8_t>& decoded = wrapper->codec->getDecodedBytes();
+  return copyBuffer(env, decoded.data(), decoded.size());
+}
+
+napi_value decoderGetPyramidBuffer(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  Wrapper<J2KDecoder>* wrapper = unwrap<J2KDecoder>(env, info, argc, argv);
+  if(!wrapper) {
+    return NULL;
+  }
+  const std::vector<uint8_t>& level = wrapper->codec->getPyramidBytes(Js<size_t>::from(env, argv[0]));
+  return copyBuffer(env, level.data(), level.size());
+}
+
+// Returns a copy of the histogram as a Uint32Array
+napi_value decoderGetHistogramBuffer(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  Wrapper<J2KDecoder>* wrapper = unwrap<J2KDecoder>(env, info, argc, argv);
+  if(!wrapper) {
+    return NULL;
+  }
+  const std::vector<uint32_t>& histogram = wrapper->codec->getHistogram(Js<size_t>::from(env, argv[0]));
+  void* data;
+  napi_value arrayBuffer, result;
+  NAPI_CALL(env, napi_create_arraybuffer(env, histogram.size() * sizeof(uint32_t), &data, &arrayBuffer));
+  std::copy(histogram.begin(), histogram.end(), (uint32_t*)data);
+  NAPI_CALL(env, napi_create_typedarray(env, napi_uint32_array, histogram.size(), arrayBuffer, 0, &result));
+  return result;
+}
+
+// Calls callback(firstRow, numRows) for each decoded band.  Returning false
+// stops the decode (status Cancelled); an exception thrown by the callback
+// also stops it and is rethrown
+napi_value decoderDecodeBands(napi_env env, napi_callback_info info) {
+  size_t argc = 3;
+  napi_value argv[3];
+  Wrapper<J2KDecoder>* wrapper = unwrap<J2KDecoder>(env, info, argc, argv);
+  if(!wrapper) {
+    return NULL;
+  }
+  napi_valuetype type = napi_undefined;
+  if(argc < 3 || napi_typeof(env, argv[2], &type) != napi_ok || type != napi_function) {
+    napi_throw_type_error(env, NULL, "openjpegjs: expected a callback function");
+    return NULL;
+  }
+  napi_value callback = argv[2];
+  J2KDecoder* decoder = wrapper->codec;
+  decoder->decodeBands(Js<size_t>::from(env, argv[0]), Js<size_t>::from(env, argv[1]),
+    [env, callback](size_t firstRow, size_t numRows) {
+      napi_value global, result;
+      napi_value args[2] = { Js<size_t>::to(env, firstRow), Js<size_t>::to(env, numRows) };
+      napi_get_global(env, &global);
+      if(napi_call_function(env, global, callback, 2, args, &result) != napi_ok) {
+        return false;
+      }
+      // only an explicit false stops, a callback without a return continues
+      bool value = true;
+      napi_valuetype type = napi_undefined;
+      if(napi_typeof(env, result, &type) == napi_ok && type == napi_boolean) {
+        napi_get_value_bool(env, result, &value);
+      }
+      return value;
+    });
+  return NULL;
+}
+
+// J2KEncoder
+
+napi_value encoderGetDecodedBuffer(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  Wrapper<J2KEncoder>* wrapper = unwrap<J2KEncoder>(env, info, argc, argv);
+  if(!wrapper) {
+    return NULL;
+  }
+  const FrameInfo frameInfo = Js<FrameInfo>::from(env, argv[0]);
+  const size_t bytesPerPixel = (frameInfo.bitsPerSample + 8 - 1) / 8;
+  const size_t size = (size_t)frameInfo.width * frameInfo.height * frameInfo.componentCount * bytesPerPixel;
+  uint8_t* data = NULL;
+  napi_value result = inputBuffer<J2KEncoder>(env, wrapper, size, data);
+  if(result) {
+    wrapper->codec->setDecodedBytes(data, size, frameInfo);
+  }
+  return result;
+}
+
+// Zero copy alternative to getDecodedBuffer() - encodes directly from the
+// passed Buffer which is kept alive until the next call
+napi_value encoderSetDecodedBuffer(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  Wrapper<J2KEncoder>* wrapper = unwrap<J2KEncoder>(env, info, argc, argv);
+  if(!wrapper) {
+    return NULL;
+  }
+  uint8_t* data;
+  size_t size;
+  if(argc < 2 || !getBytes(env, argv[0], data, size)) {
+    napi_throw_type_error(env, NULL, "openjpegjs: expected a Buffer or TypedArray and a FrameInfo");
+    return NULL;
+  }
+  pin<J2KEncoder>(env, wrapper, argv[0]);
+  wrapper->codec->setDecodedBytes(data, size, Js<FrameInfo>::from(env, argv[1]));
+  return NULL;
+}
+
+// One call alternative to setDecodedBuffer(), encode() and
+// getEncodedBuffer() like encodeFrame() in the WASM build.  The returned
+// Buffer is empty if the encode failed, see getStatus().
+napi_value encoderEncodeFrame(napi_env env, napi_callback_info info) {
+  size_t argc = 2;
+  napi_value argv[2];
+  Wrapper<J2KEncoder>* wrapper = unwrap<J2KEncoder>(env, info, argc, argv);
+  if(!wrapper) {
+    return NULL;
+  }
+  uint8_t* data;
+  size_t size;
+  if(argc < 2 || !getBytes(env, argv[0], data, size)) {
+    napi_throw_type_error(env, NULL, "openjpegjs: expected a Buffer or TypedArray and a FrameInfo");
+    return NULL;
+  }
+  pin<J2KEncoder>(env, wrapper, argv[0]);
+  J2KEncoder* encoder = wrapper->codec;
+  encoder->setDecodedBytes(data, size, Js<FrameInfo>::from(env, argv[1]));
+  encoder->encode();
+  const std::vector<uint8_t>& encoded = encoder->getEncodedBytes();
+  const size_t encodedSize = encoder->getStatus() == J2KStatus::Ok ? encoded.size() : 0;
+  return copyBuffer(env, encoded.data(), encodedSize);
+}
+
+napi_value encoderGetEncodedBuffer(napi_env env, napi_callback_info info) {
+  size_t argc = 0;
+  Wrapper<J2KEncoder>* wrapper = unwrap<J2KEncoder>(env, info, argc, NULL);
+  if(!wrapper) {
+    return NULL;
+  }
+  const std::vector<uint8_t>& encoded = wrapper->codec->getEncodedBytes();
+  return copyBuffer(env, encoded.data(), encoded.size());
+}
+
+// J2KTranscoder
+
+napi_value transcoderTranscode(napi_env env, napi_callback_info info) {
+  size_t argc = 4;
+  napi_value argv[4];
+  Wrapper<J2KTranscoder>* wrapper = unwrap<J2KTranscoder>(env, info, argc, argv);
+  if(!wrapper) {
+    return NULL;
+  }
+  if(argc < 4) {
+    napi_throw_type_error(env, NULL, "openjpegjs: missing arguments");
+    return NULL;
+  }
+  Wrapper<J2KDecoder>* decoder = unwrap<J2KDecoder>(env, argv[0]);
+  if(!decoder) {
+    return NULL;
+  }
+  Wrapper<J2KEncoder>* encoder = unwrap<J2KEncoder>(env, argv[1]);
+  if(!encoder) {
+    return NULL;
+  }
+  return Js<bool>::to(env, wrapper->codec->transcode(*decoder->codec, *encoder->codec,
+    Js<size_t>::from(env, argv[2]), Js<size_t>::from(env, argv[3])));
+}
+
+napi_value getVersion(napi_env env, napi_callback_info info) {
+  (void)info;
+  napi_value result;
+  NAPI_CALL(env, napi_create_string_utf8(env, opj_version(), NAPI_AUTO_LENGTH, &result));
+  return result;
+}
+
+napi_property_descriptor function(const char* name, napi_callback callback) {
+  napi_property_descriptor descriptor = { name, NULL, callback, NULL, NULL, NULL, napi_default, NULL };
+  return descriptor;
+}
+
+template <typename Codec>
+bool defineClass(napi_env env, napi_value exports, const char* name, const std::vector<napi_property_descriptor>& properties) {
+  napi_value constructorFunction;
+  return napi_define_class(env, name, NAPI_AUTO_LENGTH, constructor<Codec>, NULL,
+                           properties.size(), properties.data(), &constructorFunction) == napi_ok &&
+         napi_set_named_property(env, exports, name, constructorFunction) == napi_ok;
+}
+
+napi_value init(napi_env env, napi_value exports) {
+  napi_property_descriptor version = function("getVersion", getVersion);
+  NAPI_CALL(env, napi_define_properties(env, exports, 1, &version));
+
+  napi_value status;
+  NAPI_CALL(env, napi_create_object(env, &status));
+  setField(env, status, "Ok", J2KStatus::Ok);
+  setField(env, status, "Failed", J2KStatus::Failed);
+  setField(env, status, "Cancelled", J2KStatus::Cancelled);
+  setField(env, status, "LimitExceeded", J2KStatus::LimitExceeded);
+  NAPI_CALL(env, napi_set_named_property(env, exports, "J2KStatus", status));
+
+  napi_value preset;
+  NAPI_CALL(env, napi_create_object(env, &preset));
+  setField(env, preset, "FastestLossless", J2KEncodePreset::FastestLossless);
+  setField(env, preset, "Balanced", J2KEncodePreset::Balanced);
+  setField(env, preset, "Smallest", J2KEncodePreset::Smallest);
+  NAPI_CALL(env, napi_set_named_property(env, exports, "J2KEncodePreset", preset));
+
+  napi_value level;
+  NAPI_CALL(env, napi_create_object(env, &level));
+  setField(env, level, "Error", DiagnosticLevel::Error);
+  setField(env, level, "Warning", DiagnosticLevel::Warning);
+  setField(env, level, "Info", DiagnosticLevel::Info);
+  NAPI_CALL(env, napi_set_named_property(env, exports, "DiagnosticLevel", level));
+
+  napi_value code;
+  NAPI_CALL(env, napi_create_object(env, &code));
+  setField(env, code, "OpenJPEG", DiagnosticCode::OpenJPEG);
+  setField(env, code, "SetupFailed", DiagnosticCode::SetupFailed);
+  setField(env, code, "HeaderFailed", DiagnosticCode::HeaderFailed);
+  setField(env, code, "DecodeFailed", DiagnosticCode::DecodeFailed);
+  setField(env, code, "EncodeFailed", DiagnosticCode::EncodeFailed);
+  setField(env, code, "LimitExceeded", DiagnosticCode::LimitExceeded);
+  setField(env, code, "Unsupported", DiagnosticCode::Unsupported);
+  setField(env, code, "ReadFailed", DiagnosticCode::ReadFailed);
+  NAPI_CALL(env, napi_set_named_property(env, exports, "DiagnosticCode", code));
+
+  std::vector<napi_property_descriptor> decoder = {
+    function("getEncodedBuffer", decoderGetEncodedBuffer),
+    function("setEncodedBuffer", decoderSetEncodedBuffer),
+    function("getDecodedBuffer", decoderGetDecodedBuffer),
+    function("readHeader", method<&J2KDecoder::readHeader>),
+    function("calculateSizeAtDecompositionLevel", method<&J2KDecoder::calculateSizeAtDecompositionLevel>),
+    function("estimateDecode", method<&J2KDecoder::estimateDecode>),
+    function("decode", method<&J2KDecoder::decode>),
+    function("decodeFrame", decoderDecodeFrame),
+    function("decodeSubResolution", method<&J2KDecoder::decodeSubResolution>),
+    function("decodeWithinBudget", method<&J2KDecoder::decodeWithinBudget>),
+    function("decodeSlice", method<&J2KDecoder::decodeSlice>),
+    function("decodeBands", decoderDecodeBands),
+    function("beginProgressiveDecode", method<&J2KDecoder::beginProgressiveDecode>),
+    function("decodeProgressive", method<&J2KDecoder::decodeProgressive>),
+    function("endProgressiveDecode", method<&J2KDecoder::endProgressiveDecode>),
+    function("decodePyramid", method<&J2KDecoder::decodePyramid>),
+    function("getPyramidBuffer", decoderGetPyramidBuffer),
+    function("getPyramidFrameInfo", method<&J2KDecoder::getPyramidFrameInfo>),
+    function("getFrameInfo", method<&J2KDecoder::getFrameInfo>),
+    function("getNumDecompositions", method<&J2KDecoder::getNumDecompositions>),
+    function("getIsReversible", method<&J2KDecoder::getIsReversible>),
+    function("getIsHighThroughput", method<&J2KDecoder::getIsHighThroughput>),
+    function("getProgressionOrder", method<&J2KDecoder::getProgressionOrder>),
+    function("getImageOffset", method<&J2KDecoder::getImageOffset>),
+    function("getTileSize", method<&J2KDecoder::getTileSize>),
+    function("getTileOffset", method<&J2KDecoder::getTileOffset>),
+    function("getBlockDimensions", method<&J2KDecoder::getBlockDimensions>),
+    function("getNumLayers", method<&J2KDecoder::getNumLayers>),
+    function("getLayersDecoded", method<&J2KDecoder::getLayersDecoded>),
+    function("getColorSpace", method<&J2KDecoder::getColorSpace>),
+    function("getNumSlices", method<&J2KDecoder::getNumSlices>),
+    function("getDecodeResult", method<&J2KDecoder::getDecodeResult>),
+    function("setNumThreads", method<&J2KDecoder::setNumThreads>),
+    function("cancel", method<&J2KDecoder::cancel>),
+    function("setTimeLimit", method<&J2KDecoder::setTimeLimit>),
+    function("getStatus", method<&J2KDecoder::getStatus>),
+    function("setVerbosity", method<&J2KDecoder::setVerbosity>),
+    function("getNumDiagnostics", method<&J2KDecoder::getNumDiagnostics>),
+    function("getDiagnostic", method<&J2KDecoder::getDiagnostic>),
+    function("getNumErrors", method<&J2KDecoder::getNumErrors>),
+    function("getNumWarnings", method<&J2KDecoder::getNumWarnings>),
+    function("setStatistics", method<&J2KDecoder::setStatistics>),
+    function("setConvertToRGB", method<&J2KDecoder::setConvertToRGB>),
+    function("getStatistics", method<&J2KDecoder::getStatistics>),
+    function("setLimits", method<&J2KDecoder::setLimits>),
+    function("getLimits", method<&J2KDecoder::getLimits>),
+    function("getHistogramBuffer", decoderGetHistogramBuffer),
+    function("delete", destroy<J2KDecoder>),
+  };
+  if(!defineClass<J2KDecoder>(env, exports, "J2KDecoder", decoder)) {
+    napi_throw_error(env, NULL, "openjpegjs: failed to define J2KDecoder");
+    return NULL;
+  }
+
+  std::vector<napi_property_descriptor> encoder = {
+    function("getDecodedBuffer", encoderGetDecodedBuffer),
+    function("setDecodedBuffer", encoderSetDecodedBuffer),
+    function("getEncodedBuffer", encoderGetEncodedBuffer),
+    function("encode", method<&J2KEncoder::encode>),
+    function("encodeVolume", method<&J2KEncoder::encodeVolume>),
+    function("encodeFrame", encoderEncodeFrame),
+    function("estimateEncode", method<&J2KEncoder::estimateEncode>),
+    function("setDecompositions", method<&J2KEncoder::setDecompositions>),
+    function("setQuality", method<&J2KEncoder::setQuality>),
+    function("setProgressionOrder", method<&J2KEncoder::setProgressionOrder>),
+    function("setDownSample", method<&J2KEncoder::setDownSample>),
+    function("setImageOffset", method<&J2KEncoder::setImageOffset>),
+    function("setTileSize", method<&J2KEncoder::setTileSize>),
+    function("setTileOffset", method<&J2KEncoder::setTileOffset>),
+    function("setBlockDimensions", method<&J2KEncoder::setBlockDimensions>),
+    function("setCodeBlockStyle", method<&J2KEncoder::setCodeBlockStyle>),
+    function("setPreset", method<&J2KEncoder::setPreset>),
+    function("setNumPrecincts", method<&J2KEncoder::setNumPrecincts>),
+    function("setPrecinct", method<&J2KEncoder::setPrecinct>),
+    function("setCompressionRatio", method<&J2KEncoder::setCompressionRatio>),
+    function("setTargetSize", method<&J2KEncoder::setTargetSize>),
+    function("setTargetPSNR", method<&J2KEncoder::setTargetPSNR>),
+    function("setMeasurePSNR", method<&J2KEncoder::setMeasurePSNR>),
+    function("getPSNR", method<&J2KEncoder::getPSNR>),
+    function("setAutoBitDepth", method<&J2KEncoder::setAutoBitDepth>),
+    function("getEncodedBitsPerSample", method<&J2KEncoder::getEncodedBitsPerSample>),
+    function("setNumThreads", method<&J2KEncoder::setNumThreads>),
+    function("cancel", method<&J2KEncoder::cancel>),
+    function("setTimeLimit", method<&J2KEncoder::setTimeLimit>),
+    function("getStatus", method<&J2KEncoder::getStatus>),
+    function("setVerbosity", method<&J2KEncoder::setVerbosity>),
+    function("getNumDiagnostics", method<&J2KEncoder::getNumDiagnostics>),
+    function("getDiagnostic", method<&J2KEncoder::getDiagnostic>),
+    function("getNumErrors", method<&J2KEncoder::getNumErrors>),
+    function("getNumWarnings", method<&J2KEncoder::getNumWarnings>),
+    function("delete", destroy<J2KEncoder>),
+  };
+  if(!defineClass<J2KEncoder>(env, exports, "J2KEncoder", encoder)) {
+    napi_throw_error(env, NULL, "openjpegjs: failed to define J2KEncoder");
+    return NULL;
+  }
+
+  std::vector<napi_property_descriptor> transcoder = {
+    function("transcode", transcoderTranscode),
+    function("delete", destroy<J2KTranscoder>),
+  };
+  if(!defineClass<J2KTranscoder>(env, exports, "J2KTranscoder", transcoder)) {
+    napi_throw_error(env, NULL, "openjpegjs: failed to define J2KTranscoder");
+    return NULL;
+  }
+
+  return exports;
+}
+
+} // namespace
+
+NAPI_MODULE(openjpegjs, init)
@@ -0,0 +1,155 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Sweeps encoder settings (decompositions, code-block size and style,
+// precincts, tiling and quality layers) over the raw fixtures and reports
+// encode time vs compressed size for each combination, followed by the
+// presets.  Combinations on the time/size Pareto front of a fixture are
+// marked with '*'.  Pass fixture names to limit the sweep, e.g.
+// autotune CT1 MG1
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../../src/J2KEncoder.hpp"
+#include "util.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Fixture {
+    const char* name;
+    FrameInfo frameInfo;
+};
+
+static const Fixture fixtures[] = {
+  {"CT1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}},
+  {"MR1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}},
+  {"MR2", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false}},
+  {"NM1", {.width = 256, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}},
+  {"US1", {.width = 640, .height = 480, .bitsPerSample = 8, .componentCount = 3, .isSigned = false}},
+  {"VL1", {.width = 756, .height = 486, .bitsPerSample = 8, .componentCount = 3, .isSigned = false}},
+  {"XA1", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false}},
+};
+
+struct Settings {
+    std::string label;
+    size_t decompositions;
+    Size blockDimensions;
+    size_t codeBlockStyle;
+    Size precinct; // 0x0 = none
+    Size tileSize; // 0x0 = untiled
+    size_t numLayers; // lossless final layer, lossy layers at 40:1 and 10:1 before it
+    bool preset;
+    J2KEncodePreset presetValue;
+};
+
+struct Result {
+    std::string label;
+    double ms;
+    size_t bytes;
+};
+
+void configure(J2KEncoder& encoder, const Settings& settings) {
+    if(settings.preset) {
+        encoder.setPreset(settings.presetValue);
+        return;
+    }
+    const float ratios[] = {40, 10};
+    encoder.setQuality(true, settings.numLayers);
+    for(size_t layer = 0; layer + 1 < settings.numLayers; layer++) {
+        encoder.setCompressionRatio(layer, ratios[std::min<size_t>(layer, 1)]);
+    }
+    encoder.setCompressionRatio(settings.numLayers - 1, 0);
+    encoder.setDecompositions(settings.decompositions);
+    encoder.setBlockDimensions(settings.blockDimensions);
+    encoder.setCodeBlockStyle(settings.codeBlockStyle);
+    encoder.setTileSize(settings.tileSize);
+    if(settings.precinct.width) {
+        encoder.setNumPrecincts(1);
+        encoder.setPrecinct(0, settings.precinct);
+    }
+}
+
+std::vector<Settings> sweep() {
+    std::vector<Settings> result;
+    const size_t decompositions[] = {3, 5, 6};
+    const Size blocks[] = {Size(32, 32), Size(64, 64), Size(64, 32)};
+    const size_t styles[] = {0, 1};
+    const Size precincts[] = {Size(), Size(128, 128)};
+    const Size tiles[] = {Size(), Size(512, 512)};
+    const size_t layers[] = {1, 3};
+    for(size_t d : decompositions)
+    for(const Size& b : blocks)
+    for(size_t s : styles)
+    for(const Size& p : precincts)
+    for(const Size& t : tiles)
+    for(size_t l : layers) {
+        char label[256];
+        snprintf(label, sizeof(label), "decompositions=%zu block=%ux%u style=%zu precinct=%ux%u tile=%ux%u layers=%zu",
+            d, b.width, b.height, s, p.width, p.height, t.width, t.height, l);
+        result.push_back({label, d, b, s, p, t, l, false, J2KEncodePreset::Balanced});
+    }
+    result.push_back({"preset=FastestLossless", 0, Size(), 0, Size(), Size(), 1, true, J2KEncodePreset::FastestLossless});
+    result.push_back({"preset=Balanced", 0, Size(), 0, Size(), Size(), 1, true, J2KEncodePreset::Balanced});
+    result.push_back({"preset=Smallest", 0, Size(), 0, Size(), Size(), 1, true, J2KEncodePreset::Smallest});
+    return result;
+}
+
+void tune(const Fixture& fixture, const std::vector<Settings>& settings, size_t iterations) {
+    std::string inPath = "test/fixtures/raw/";
+    inPath += fixture.name;
+    inPath += ".RAW";
+    std::vector<uint8_t> raw;
+    readFile(inPath, raw);
+    if(raw.empty()) {
+        printf("Native-autotune %s missing\n", fixture.name);
+        return;
+    }
+
+    std::vector<Result> results;
+    for(const Settings& s : settings) {
+        J2KEncoder encoder;
+        encoder.setDecodedBytes(raw.data(), raw.size(), fixture.frameInfo);
+        configure(encoder, s);
+        double best = 0;
+        for(size_t i = 0; i < iterations; i++) {
+            const Clock::time_point start = Clock::now();
+            encoder.encode();
+            const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            best = (i == 0) ? ms : std::min(best, ms);
+        }
+        if(encoder.getStatus() != J2KStatus::Ok) {
+            continue;
+        }
+        results.push_back({s.label, best, encoder.getEncodedBytes().size()});
+    }
+
+    for(const Result& r : results) {
+        bool dominated = false;
+        for(const Result& other : results) {
+            if(other.ms <= r.ms && other.bytes <= r.bytes && (other.ms < r.ms || other.bytes < r.bytes)) {
+                dominated = true;
+                break;
+            }
+        }
+        printf("Native-autotune %s %s ms=%f bytes=%zu ratio=%f%s\n", fixture.name, r.label.c_str(), r.ms, r.bytes,
+            (double)raw.size() / r.bytes, dominated ? "" : " *");
+    }
+}
+
+int main(int argc, char** argv) {
+    const std::vector<Settings> settings = sweep();
+    const size_t iterations = 3;
+    for(const Fixture& fixture : fixtures) {
+        bool selected = argc < 2;
+        for(int i = 1; i < argc; i++) {
+            selected = selected || std::string(argv[i]) == fixture.name;
+        }
+        if(selected) {
+            tune(fixture, settings, iterations);
+        }
+    }
+    return 0;
+}
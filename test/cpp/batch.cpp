@@ -0,0 +1,66 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Decodes a list of files with FileBatchDecoder for an increasing read ahead
+// and reports the time spent waiting for reads vs decoding.  Each file is
+// dropped from the page cache before every run (posix_fadvise) so the reads
+// are cold.  Without file arguments the j2k fixtures are used.  Usage:
+// batchbench [maxReadAhead] [file ...]
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../../src/FileBatchDecoder.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+static const char* fixtures[] = {
+  "CT1", "CT2", "MR1", "MR2", "MR3", "MR4", "NM1", "RG2", "RG3", "SC1", "US1", "VL1", "VL2", "VL3", "VL6", "XA1"
+};
+
+void dropFromCache(const std::vector<std::string>& paths) {
+  for(const std::string& path : paths) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if(fd >= 0) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+  }
+}
+
+void batch(const std::vector<std::string>& paths, size_t readAhead) {
+  dropFromCache(paths);
+  FileBatchDecoder decoder(readAhead, std::max<size_t>(1, readAhead));
+  size_t failed = 0;
+  const Clock::time_point start = Clock::now();
+  decoder.decode(paths, [&failed](size_t, J2KDecoder&, J2KStatus status) {
+    failed += (status != J2KStatus::Ok);
+  });
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  printf("Native-batch readAhead=%zu backend=%s files=%zu MB=%f seconds=%f ioWaitMS=%f decodeMS=%f MB/s=%f failed=%zu\n",
+    readAhead, decoder.getBackend(), paths.size(), decoder.getBytesRead() / 1000000.0, seconds,
+    decoder.getIOWaitMS(), decoder.getDecodeMS(), decoder.getBytesRead() / seconds / 1000000.0, failed);
+}
+
+int main(int argc, char** argv) {
+  const size_t maxReadAhead = (argc > 1) ? atoi(argv[1]) : 8;
+  std::vector<std::string> paths;
+  for(int i = 2; i < argc; i++) {
+    paths.push_back(argv[i]);
+  }
+  if(paths.empty()) {
+    for(const char* name : fixtures) {
+      paths.push_back(std::string("test/fixtures/j2k/") + name + ".j2k");
+    }
+  }
+
+  batch(paths, 0);
+  for(size_t readAhead = 1; readAhead <= maxReadAhead; readAhead *= 2) {
+    batch(paths, readAhead);
+  }
+  return 0;
+}
@@ -0,0 +1,192 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Generates deterministic synthetic images (noise, gradient and a CT-like
+// texture) from 256x256 up to maxSize x maxSize, at 8/12/16 bits with 1
+// and 3 components, encodes and decodes each with several settings and
+// thread counts and reports throughput in megapixels per second so cache
+// cliffs and nonlinear scaling show up as the pixel count grows.  openjp2
+// only uses more than one thread when it is built with OPJ_USE_THREAD, which
+// the build leaves off, without it only 1 thread is run so the results don't
+// show thread counts that make no difference.
+// Usage: corpusbench [maxSize] [maxThreads]
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "../../src/J2KDecoder.hpp"
+#include "../../src/J2KEncoder.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+enum class Pattern {
+  Noise,
+  Gradient,
+  Texture
+};
+
+static const char* patternNames[] = {"noise", "gradient", "texture"};
+
+struct Setting {
+  const char* label;
+  bool lossless;
+  float ratio;
+  J2KEncodePreset preset;
+  bool usePreset;
+};
+
+static const Setting settings[] = {
+  {"lossless", true, 0, J2KEncodePreset::Balanced, false},
+  {"lossy20", false, 20, J2KEncodePreset::Balanced, false},
+  {"fastest", true, 0, J2KEncodePreset::FastestLossless, true},
+};
+
+// xorshift32, the same sequence on every platform
+struct Random {
+  Random(uint32_t seed) : state(seed ? seed : 1) {}
+  uint32_t next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+  uint32_t state;
+};
+
+// Sample at (x, y) of component c in [0, 1)
+double sample(Pattern pattern, size_t x, size_t y, size_t c, size_t size, Random& random) {
+  const double u = (double)x / size;
+  const double v = (double)y / size;
+  switch(pattern) {
+    case Pattern::Noise:
+      return (random.next() >> 8) / 16777216.0;
+    case Pattern::Gradient:
+      return std::fmod(u * 0.7 + v * 0.3 + c * 0.1, 1.0);
+    case Pattern::Texture: {
+      // air outside an elliptical body, soft tissue with slow variation,
+      // a few dense structures and a little noise
+      const double dx = (u - 0.5) / 0.42;
+      const double dy = (v - 0.5) / 0.36;
+      const double r = dx * dx + dy * dy;
+      double value = 0.02;
+      if(r < 1) {
+        value = 0.45 + 0.05 * sin(u * 23.0 + c) * cos(v * 17.0);
+        const double bx = (u - 0.62) / 0.08;
+        const double by = (v - 0.55) / 0.05;
+        if(bx * bx + by * by < 1) {
+          value = 0.9;
+        }
+      }
+      value += ((random.next() >> 8) / 16777216.0 - 0.5) * 0.02;
+      return std::max(0.0, std::min(value, 0.999));
+    }
+  }
+  return 0;
+}
+
+std::vector<uint8_t> generate(Pattern pattern, size_t size, size_t bitsPerSample, size_t componentCount) {
+  const size_t bytesPerSample = (bitsPerSample + 7) / 8;
+  std::vector<uint8_t> pixels(size * size * componentCount * bytesPerSample);
+  Random random((uint32_t)(size * 31 + bitsPerSample * 7 + componentCount));
+  const double maxValue = (double)((1u << bitsPerSample) - 1);
+  for(size_t y = 0; y < size; y++) {
+    for(size_t x = 0; x < size; x++) {
+      for(size_t c = 0; c < componentCount; c++) {
+        const uint32_t value = (uint32_t)(sample(pattern, x, y, c, size, random) * maxValue);
+        const size_t index = (y * size + x) * componentCount + c;
+        if(bytesPerSample == 1) {
+          pixels[index] = (uint8_t)value;
+        } else {
+          ((uint16_t*)pixels.data())[index] = (uint16_t)value;
+        }
+      }
+    }
+  }
+  return pixels;
+}
+
+double elapsedMS(const Clock::time_point& start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void run(Pattern pattern, size_t size, size_t bitsPerSample, size_t componentCount, const std::vector<uint8_t>& pixels,
+         const Setting& setting, size_t numThreads) {
+  FrameInfo frameInfo;
+  frameInfo.width = size;
+  frameInfo.height = size;
+  frameInfo.bitsPerSample = bitsPerSample;
+  frameInfo.componentCount = componentCount;
+  frameInfo.isSigned = false;
+
+  J2KEncoder encoder;
+  encoder.setDecodedBytes(pixels.data(), pixels.size(), frameInfo);
+  if(setting.usePreset) {
+    encoder.setPreset(setting.preset);
+  } else {
+    encoder.setQuality(setting.lossless, 1);
+    encoder.setCompressionRatio(0, setting.ratio);
+  }
+  encoder.setNumThreads(numThreads);
+  Clock::time_point start = Clock::now();
+  encoder.encode();
+  const double encodeMS = elapsedMS(start);
+  if(encoder.getStatus() != J2KStatus::Ok) {
+    printf("Native-corpus %s %zu %zubit %zuc %s threads=%zu encode failed\n", patternNames[(int)pattern], size,
+      bitsPerSample, componentCount, setting.label, numThreads);
+    return;
+  }
+
+  J2KDecoder decoder;
+  decoder.setEncodedBytes(encoder.getEncodedBytes().data(), encoder.getEncodedBytes().size());
+  decoder.setNumThreads(numThreads);
+  start = Clock::now();
+  decoder.decode();
+  const double decodeMS = elapsedMS(start);
+
+  const double megapixels = (double)size * size / 1000000.0;
+  printf("Native-corpus %s %zu %zubit %zuc %s threads=%zu pixels=%zu ratio=%f encodeMS=%f encodeMP/s=%f decodeMS=%f decodeMP/s=%f%s\n",
+    patternNames[(int)pattern], size, bitsPerSample, componentCount, setting.label, numThreads, size * size,
+    (double)pixels.size() / encoder.getEncodedBytes().size(), encodeMS, megapixels / (encodeMS / 1000.0),
+    decodeMS, megapixels / (decodeMS / 1000.0), decoder.getStatus() == J2KStatus::Ok ? "" : " decode failed");
+}
+
+int main(int argc, char** argv) {
+  const size_t maxSize = (argc > 1) ? atoi(argv[1]) : 4096;
+  size_t maxThreads = (argc > 2) ? atoi(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+  if(maxThreads > 1 && !opj_has_thread_support()) {
+    printf("Native-corpus openjp2 built without OPJ_USE_THREAD, running 1 thread only\n");
+    maxThreads = 1;
+  }
+  const size_t bitDepths[] = {8, 12, 16};
+  const size_t componentCounts[] = {1, 3};
+  const Pattern patterns[] = {Pattern::Noise, Pattern::Gradient, Pattern::Texture};
+
+  for(size_t size = 256; size <= maxSize && size <= 16384; size *= 2) {
+    for(size_t bitsPerSample : bitDepths) {
+      for(size_t componentCount : componentCounts) {
+        // a 16k x 16k color image needs several GB for the raw, encoded
+        // and decoded copies
+        if(componentCount > 1 && size > 8192) {
+          continue;
+        }
+        for(Pattern pattern : patterns) {
+          const std::vector<uint8_t> pixels = generate(pattern, size, bitsPerSample, componentCount);
+          for(const Setting& setting : settings) {
+            for(size_t numThreads = 1; ; numThreads = std::min(numThreads * 2, maxThreads)) {
+              run(pattern, size, bitsPerSample, componentCount, pixels, setting, numThreads);
+              if(numThreads >= maxThreads) {
+                break;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
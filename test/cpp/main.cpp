@@ -7,56 +7,13 @@
 #include <iterator>
 #include <time.h> 
 #include <algorithm>
+#include <cmath>
 
+#include "../../src/EncapsulatedFrameReader.hpp"
 #include "../../src/J2KDecoder.hpp"
 #include "../../src/J2KEncoder.hpp"
-
-void readFile(std::string fileName, std::vector<uint8_t>& vec) {
-    // open the file:
-    std::ifstream file(fileName, std::ios::in | std::ios::binary);
-    // Stop eating new lines in binary mode!!!
-    file.unsetf(std::ios::skipws);
-
-    // get its size:
-    std::streampos fileSize;
-    file.seekg(0, std::ios::end);
-    fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    // reserve capacity
-    vec.reserve(fileSize);
-
-    // read the data:
-    vec.insert(vec.begin(),
-                std::istream_iterator<uint8_t>(file),
-                std::istream_iterator<uint8_t>());
-
-    //std::istreambuf_iterator iter(file);
-    //std::copy(iter.begin(), iter.end(), std::back_inserter(vec));
-}
-
-void writeFile(std::string fileName, const std::vector<uint8_t>& vec) {
-    std::ofstream file(fileName, std::ios::out | std::ofstream::binary);
-    std::copy(vec.begin(), vec.end(), std::ostreambuf_iterator<char>(file));
-}
-
-enum { NS_PER_SECOND = 1000000000 };
-
-void sub_timespec(struct timespec t1, struct timespec t2, struct timespec *td)
-{
-    td->tv_nsec = t2.tv_nsec - t1.tv_nsec;
-    td->tv_sec  = t2.tv_sec - t1.tv_sec;
-    if (td->tv_sec > 0 && td->tv_nsec < 0)
-    {
-        td->tv_nsec += NS_PER_SECOND;
-        td->tv_sec--;
-    }
-    else if (td->tv_sec < 0 && td->tv_nsec > 0)
-    {
-        td->tv_nsec -= NS_PER_SECOND;
-        td->tv_sec++;
-    }
-}
+#include "../../src/J2KTranscoder.hpp"
+#include "util.hpp"
 
 void decodeFile(const char* imageName, size_t iterations = 1) {
     std::string inPath = "test/fixtures/j2k/";
@@ -65,7 +22,10 @@ void decodeFile(const char* imageName, size_t iterations = 1) {
     
     J2KDecoder decoder;
     std::vector<uint8_t>& encodedBytes = decoder.getEncodedBytes();
-    readFile(inPath, encodedBytes);
+    if(!readFile(inPath, encodedBytes)) {
+        printf("Native-decode %s missing\n", imageName);
+        return;
+    }
 
     // cut buffer in half to test partial decoding
     //const size_t numBytes = 25050;
@@ -95,7 +55,10 @@ void encodeFile(const char* imageName, const FrameInfo frameInfo, size_t iterati
 
     J2KEncoder encoder;
     std::vector<uint8_t>& rawBytes = encoder.getDecodedBytes(frameInfo);
-    readFile(inPath, rawBytes);
+    if(!readFile(inPath, rawBytes)) {
+        printf("Native-encode %s missing\n", imageName);
+        return;
+    }
 
     timespec start, finish, delta;
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
@@ -113,6 +76,731 @@ void encodeFile(const char* imageName, const FrameInfo frameInfo, size_t iterati
     }*/
 }
 
+void encodeTargetFile(const char* imageName, const FrameInfo frameInfo, size_t targetSize, float targetPSNR) {
+    std::string inPath = "test/fixtures/raw/";
+    inPath += imageName;
+    inPath += ".RAW";
+
+    J2KEncoder encoder;
+    std::vector<uint8_t>& rawBytes = encoder.getDecodedBytes(frameInfo);
+    if(!readFile(inPath, rawBytes)) {
+        printf("Native-encodeTarget %s missing\n", imageName);
+        return;
+    }
+    encoder.setQuality(false, 1);
+    encoder.setCompressionRatio(0, 0);
+    encoder.setTargetSize(targetSize);
+    encoder.setTargetPSNR(targetPSNR);
+    encoder.setMeasurePSNR(true);
+
+    timespec start, finish, delta;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+
+    encoder.encode();
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double ns = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+    printf("Native-encodeTarget %s targetSize=%zu targetPSNR=%f size=%zu psnr=%f %f\n", imageName, targetSize, targetPSNR,
+        encoder.getEncodedBytes().size(), encoder.getPSNR(), ns/1000000.0);
+}
+
+// Encodes a fixture losslessly and at a 20:1 ratio with setMeasurePSNR()
+// and checks getPSNR() is infinite for the lossless bitstream and finite
+// and positive for the lossy one
+void measurePSNRFile(const char* imageName, const FrameInfo frameInfo) {
+    std::string inPath = "test/fixtures/raw/";
+    inPath += imageName;
+    inPath += ".RAW";
+
+    J2KEncoder encoder;
+    std::vector<uint8_t>& rawBytes = encoder.getDecodedBytes(frameInfo);
+    if(!readFile(inPath, rawBytes)) {
+        printf("Native-measurePSNR %s missing\n", imageName);
+        return;
+    }
+    encoder.setMeasurePSNR(true);
+
+    encoder.setQuality(true, 1);
+    encoder.setCompressionRatio(0, 0);
+    const J2KStatus losslessStatus = encoder.encode();
+    const double lossless = encoder.getPSNR();
+
+    encoder.setQuality(false, 1);
+    encoder.setCompressionRatio(0, 20);
+    const J2KStatus lossyStatus = encoder.encode();
+    const double lossy = encoder.getPSNR();
+
+    const bool ok = losslessStatus == J2KStatus::Ok && lossyStatus == J2KStatus::Ok &&
+        std::isinf(lossless) && std::isfinite(lossy) && lossy > 0;
+    printf("Native-measurePSNR %s lossless=%f lossy=%f ok=%d\n", imageName, lossless, lossy, ok);
+}
+
+// Converts an 8 bit RGB fixture to planar YCbCr 4:2:0, encodes it with down
+// sampled chroma and decodes it back to interleaved RGB
+void subsampledFile(const char* imageName, const FrameInfo frameInfo, size_t iterations = 1) {
+    std::string inPath = "test/fixtures/raw/";
+    inPath += imageName;
+    inPath += ".RAW";
+    std::vector<uint8_t> rgb;
+    readFile(inPath, rgb);
+    if(rgb.size() < (size_t)frameInfo.width * frameInfo.height * 3) {
+        printf("Native-subsampled %s missing\n", imageName);
+        return;
+    }
+
+    const size_t width = frameInfo.width;
+    const size_t height = frameInfo.height;
+    const size_t chromaWidth = (width + 1) / 2;
+    const size_t chromaHeight = (height + 1) / 2;
+    J2KEncoder encoder;
+    std::vector<uint8_t>& planar = encoder.getDecodedBytes(frameInfo);
+    planar.assign(width * height + chromaWidth * chromaHeight * 2, 0);
+    uint8_t* pY = planar.data();
+    uint8_t* pCb = pY + width * height;
+    uint8_t* pCr = pCb + chromaWidth * chromaHeight;
+    for(size_t y = 0; y < height; y++) {
+        for(size_t x = 0; x < width; x++) {
+            const uint8_t* p = &rgb[(y * width + x) * 3];
+            const double luma = 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2];
+            pY[y * width + x] = (uint8_t)std::min(255.0, luma + 0.5);
+            if(y % 2 == 0 && x % 2 == 0) {
+                pCb[(y / 2) * chromaWidth + x / 2] = (uint8_t)std::max(0.0, std::min(255.0, 128 + (p[2] - luma) * 0.564 + 0.5));
+                pCr[(y / 2) * chromaWidth + x / 2] = (uint8_t)std::max(0.0, std::min(255.0, 128 + (p[0] - luma) * 0.713 + 0.5));
+            }
+        }
+    }
+    encoder.setDownSample(1, Point(2, 2));
+    encoder.setDownSample(2, Point(2, 2));
+
+    timespec start, finish, delta;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for(int i=0; i < iterations; i++) {
+        encoder.encode();
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double encodeMS = (delta.tv_sec * 1000000000.0 + delta.tv_nsec) / 1000000.0 / iterations;
+
+    J2KDecoder decoder;
+    decoder.setEncodedBytes(encoder.getEncodedBytes().data(), encoder.getEncodedBytes().size());
+    decoder.setConvertToRGB(true);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for(int i=0; i < iterations; i++) {
+        decoder.decode();
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double decodeMS = (delta.tv_sec * 1000000000.0 + delta.tv_nsec) / 1000000.0 / iterations;
+
+    // 4:2:0 is lossy, report the largest difference from the source RGB
+    const std::vector<uint8_t>& decoded = decoder.getDecodedBytes();
+    int maxError = -1;
+    if(decoded.size() == width * height * 3) {
+        maxError = 0;
+        for(size_t i = 0; i < decoded.size(); i++) {
+            maxError = std::max(maxError, std::abs((int)decoded[i] - (int)rgb[i]));
+        }
+    }
+    printf("Native-subsampled %s 4:2:0 size=%zu encode=%f decode=%f maxError=%d\n", imageName,
+        encoder.getEncodedBytes().size(), encodeMS, decodeMS, maxError);
+}
+
+// Scales the signed 16 bit samples of a fixture down to signed 8 bit
+// samples between -32 and 31
+std::vector<uint8_t> signed8Bytes(const std::vector<uint8_t>& rawBytes) {
+    std::vector<uint8_t> samples(rawBytes.size() / 2);
+    const int16_t* pIn = (const int16_t*)rawBytes.data();
+    for(size_t i = 0; i < samples.size(); i++) {
+        samples[i] = (uint8_t)(int8_t)std::max(-32, std::min(pIn[i] / 64, 31));
+    }
+    return samples;
+}
+
+// Encodes rawBytes at bitsPerSample and with setAutoBitDepth(), decodes the
+// auto bit depth bitstream and checks the original samples come back
+void autoBitDepth(const char* imageName, const std::vector<uint8_t>& rawBytes, const FrameInfo frameInfo, size_t iterations) {
+    double encodeMS[2];
+    size_t encodedSize[2];
+    J2KEncoder encoder;
+    for(size_t autoBitDepth = 0; autoBitDepth < 2; autoBitDepth++) {
+        encoder.setDecodedBytes(rawBytes.data(), rawBytes.size(), frameInfo);
+        encoder.setAutoBitDepth(autoBitDepth != 0);
+        timespec start, finish, delta;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+        for(int i=0; i < iterations; i++) {
+            encoder.encode();
+        }
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+        sub_timespec(start, finish, &delta);
+        encodeMS[autoBitDepth] = (delta.tv_sec * 1000000000.0 + delta.tv_nsec) / 1000000.0 / iterations;
+        encodedSize[autoBitDepth] = encoder.getEncodedBytes().size();
+    }
+
+    J2KDecoder decoder;
+    decoder.setEncodedBytes(encoder.getEncodedBytes().data(), encoder.getEncodedBytes().size());
+    decoder.decode();
+    const bool restored = decoder.getFrameInfo().bitsPerSample == frameInfo.bitsPerSample &&
+                          decoder.getDecodedBytes() == rawBytes;
+    printf("Native-autoBitDepth %s bitsPerSample=%zu size=%zu/%zu encode=%f/%f restored=%d\n", imageName,
+        encoder.getEncodedBitsPerSample(), encodedSize[0], encodedSize[1], encodeMS[0], encodeMS[1], restored);
+}
+
+void autoBitDepthFile(const char* imageName, const FrameInfo frameInfo, size_t iterations = 1) {
+    std::string inPath = "test/fixtures/raw/";
+    inPath += imageName;
+    inPath += ".RAW";
+    std::vector<uint8_t> rawBytes;
+    readFile(inPath, rawBytes);
+    if(rawBytes.empty()) {
+        printf("Native-autoBitDepth %s missing\n", imageName);
+        return;
+    }
+    autoBitDepth(imageName, rawBytes, frameInfo, iterations);
+}
+
+// Runs autoBitDepth() on signed 8 bit samples made from a signed 16 bit
+// fixture, which only need 6 bits
+void autoBitDepthSigned8File(const char* imageName, const FrameInfo frameInfo, size_t iterations = 1) {
+    std::string inPath = "test/fixtures/raw/";
+    inPath += imageName;
+    inPath += ".RAW";
+    std::vector<uint8_t> rawBytes;
+    readFile(inPath, rawBytes);
+    if(rawBytes.size() < (size_t)frameInfo.width * frameInfo.height * 2) {
+        printf("Native-autoBitDepth %s signed 8 bit missing\n", imageName);
+        return;
+    }
+    autoBitDepth((std::string(imageName) + " signed 8 bit").c_str(), signed8Bytes(rawBytes), frameInfo, iterations);
+}
+
+// Encodes numSlices slices made from rawBytes shifted down one row per
+// slice, like adjacent slices of a series, as independent frames and as a
+// volume, and checks the volume decodes losslessly, whole and per slice
+void volumeSlices(const char* imageName, const std::vector<uint8_t>& rawBytes, const FrameInfo frameInfo, size_t numSlices, size_t iterations) {
+    const size_t rowBytes = (size_t)frameInfo.width * ((frameInfo.bitsPerSample + 7) / 8);
+    const size_t sliceBytes = rowBytes * frameInfo.height;
+    std::vector<uint8_t> volume(sliceBytes * numSlices);
+    for(size_t slice = 0; slice < numSlices; slice++) {
+        for(size_t y = 0; y < frameInfo.height; y++) {
+            const size_t source = std::min<size_t>(y + slice, frameInfo.height - 1);
+            memcpy(&volume[slice * sliceBytes + y * rowBytes], &rawBytes[source * rowBytes], rowBytes);
+        }
+    }
+
+    J2KEncoder encoder;
+    size_t framesSize = 0;
+    for(size_t slice = 0; slice < numSlices; slice++) {
+        encoder.setDecodedBytes(&volume[slice * sliceBytes], sliceBytes, frameInfo);
+        encoder.encode();
+        framesSize += encoder.getEncodedBytes().size();
+    }
+
+    FrameInfo volumeInfo = frameInfo;
+    volumeInfo.componentCount = (uint8_t)numSlices;
+    encoder.setDecodedBytes(volume.data(), volume.size(), volumeInfo);
+    timespec start, finish, delta;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for(int i=0; i < iterations; i++) {
+        encoder.encodeVolume();
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double encodeMS = (delta.tv_sec * 1000000000.0 + delta.tv_nsec) / 1000000.0 / iterations;
+
+    J2KDecoder decoder;
+    decoder.setEncodedBytes(encoder.getEncodedBytes().data(), encoder.getEncodedBytes().size());
+    decoder.decode();
+    const bool lossless = decoder.getNumSlices() == numSlices && decoder.getDecodedBytes() == volume;
+    const size_t slice = numSlices / 2 + 1;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    decoder.decodeSlice(slice, 0);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double sliceMS = (delta.tv_sec * 1000000000.0 + delta.tv_nsec) / 1000000.0;
+    const bool sliceLossless = decoder.getFrameInfo().componentCount == 1 && decoder.getDecodedBytes().size() == sliceBytes &&
+        std::equal(volume.begin() + slice * sliceBytes, volume.begin() + (slice + 1) * sliceBytes, decoder.getDecodedBytes().begin());
+    printf("Native-volume %s slices=%zu size=%zu/%zu encode=%f decodeSlice=%f lossless=%d/%d\n", imageName, numSlices,
+        framesSize, encoder.getEncodedBytes().size(), encodeMS, sliceMS, lossless, sliceLossless);
+}
+
+void volumeFile(const char* imageName, const FrameInfo frameInfo, size_t numSlices, size_t iterations = 1) {
+    std::string inPath = "test/fixtures/raw/";
+    inPath += imageName;
+    inPath += ".RAW";
+    std::vector<uint8_t> rawBytes;
+    readFile(inPath, rawBytes);
+    if(rawBytes.size() < (size_t)frameInfo.width * frameInfo.height * ((frameInfo.bitsPerSample + 7) / 8)) {
+        printf("Native-volume %s missing\n", imageName);
+        return;
+    }
+    volumeSlices(imageName, rawBytes, frameInfo, numSlices, iterations);
+}
+
+// Runs volumeSlices() on signed 8 bit samples made from a signed 16 bit fixture
+void volumeSigned8File(const char* imageName, const FrameInfo frameInfo, size_t numSlices, size_t iterations = 1) {
+    std::string inPath = "test/fixtures/raw/";
+    inPath += imageName;
+    inPath += ".RAW";
+    std::vector<uint8_t> rawBytes;
+    readFile(inPath, rawBytes);
+    if(rawBytes.size() < (size_t)frameInfo.width * frameInfo.height * 2) {
+        printf("Native-volume %s signed 8 bit missing\n", imageName);
+        return;
+    }
+    volumeSlices((std::string(imageName) + " signed 8 bit").c_str(), signed8Bytes(rawBytes), frameInfo, numSlices, iterations);
+}
+
+double decodeMS(J2KDecoder& decoder, size_t iterations) {
+    timespec start, finish, delta;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for(int i=0; i < iterations; i++) {
+        decoder.decode();
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    return (delta.tv_sec * 1000000000.0 + delta.tv_nsec) / 1000000.0 / iterations;
+}
+
+// Encodes a fixture with 4 quality layers and decodes it repeatedly within
+// a quarter, half and all of the time a full decode takes, printing the
+// layers decodeWithinBudget() settled on and the average decode time
+void decodeBudgetFile(const char* imageName, const FrameInfo frameInfo, size_t frames = 10) {
+    std::string inPath = "test/fixtures/raw/";
+    inPath += imageName;
+    inPath += ".RAW";
+    std::vector<uint8_t> rawBytes;
+    readFile(inPath, rawBytes);
+    if(rawBytes.empty()) {
+        printf("Native-decodeBudget %s missing\n", imageName);
+        return;
+    }
+
+    J2KEncoder encoder;
+    encoder.setDecodedBytes(rawBytes.data(), rawBytes.size(), frameInfo);
+    encoder.setQuality(true, 4);
+    encoder.setCompressionRatio(0, 80);
+    encoder.setCompressionRatio(1, 40);
+    encoder.setCompressionRatio(2, 10);
+    encoder.setCompressionRatio(3, 0);
+    encoder.encode();
+
+    J2KDecoder decoder;
+    decoder.setEncodedBytes(encoder.getEncodedBytes().data(), encoder.getEncodedBytes().size());
+    const double fullMS = decodeMS(decoder, frames);
+
+    const double fractions[] = {0.25, 0.5, 1.0};
+    for(size_t i = 0; i < 3; i++) {
+        const double budget = fullMS * fractions[i];
+        double totalMS = 0;
+        for(size_t frame = 0; frame < frames; frame++) {
+            timespec start, finish, delta;
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+            decoder.decodeWithinBudget(budget, 0);
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+            sub_timespec(start, finish, &delta);
+            totalMS += (delta.tv_sec * 1000000000.0 + delta.tv_nsec) / 1000000.0;
+        }
+        printf("Native-decodeBudget %s budget=%f layers=%zu/%d %f\n", imageName, budget,
+            decoder.getLayersDecoded(), decoder.getNumLayers(), totalMS / frames);
+    }
+}
+
+// Decodes the HTJ2K (Part 15) version of a fixture and the classic one,
+// reports the speedup of the HT block decoder and checks the HT decode
+// matches the raw pixels (the HT fixtures are encoded reversibly, see the
+// README)
+void decodeHighThroughputFile(const char* imageName, size_t iterations = 1) {
+    std::string htPath = "test/fixtures/htj2k/";
+    htPath += imageName;
+    htPath += ".j2c";
+    std::string classicPath = "test/fixtures/j2k/";
+    classicPath += imageName;
+    classicPath += ".j2k";
+
+    J2KDecoder ht;
+    readFile(htPath, ht.getEncodedBytes());
+    J2KDecoder classic;
+    readFile(classicPath, classic.getEncodedBytes());
+    if(ht.getEncodedBytes().empty() || classic.getEncodedBytes().empty()) {
+        printf("Native-decodeHT %s missing\n", imageName);
+        return;
+    }
+
+    std::string rawPath = "test/fixtures/raw/";
+    rawPath += imageName;
+    rawPath += ".RAW";
+    std::vector<uint8_t> rawBytes;
+    readFile(rawPath, rawBytes);
+
+    const double htMS = decodeMS(ht, iterations);
+    const double classicMS = decodeMS(classic, iterations);
+    const bool matches = ht.getStatus() == J2KStatus::Ok && ht.getDecodedBytes() == rawBytes;
+    printf("Native-decodeHT %s isHighThroughput=%d ht=%f classic=%f speedup=%f matches=%d\n", imageName,
+        ht.getIsHighThroughput(), htMS, classicMS, htMS > 0 ? classicMS / htMS : 0.0, matches);
+}
+
+// Decodes a fixture under limits it fits in, then with its SIZ marker
+// patched to 60000x60000 and with its COD marker patched to 4x4 code-blocks
+// to check the decode fails fast before allocating or entropy decoding
+void decodeLimitsFile(const char* imageName) {
+    std::string inPath = "test/fixtures/j2k/";
+    inPath += imageName;
+    inPath += ".j2k";
+    std::vector<uint8_t> encoded;
+    readFile(inPath, encoded);
+    if(encoded.size() < 16) {
+        printf("Native-decodeLimits %s missing\n", imageName);
+        return;
+    }
+
+    DecodeLimits limits = {};
+    limits.maxPixels = 16 * 1024 * 1024;
+    limits.maxComponents = 4;
+    limits.maxTiles = 4096;
+    limits.maxMemory = 256 * 1024 * 1024;
+    limits.maxDecodeTime = 5000;
+    limits.maxCodeBlocks = 4096;
+
+    std::vector<uint8_t> crafted(encoded);
+    const uint8_t large[] = {0x00, 0x00, 0xEA, 0x60};
+    memcpy(&crafted[8], large, 4);  // Xsiz
+    memcpy(&crafted[12], large, 4); // Ysiz
+
+    std::vector<uint8_t> blocks(encoded);
+    for(size_t p = 2; p + 12 <= blocks.size(); p++) {
+        if(blocks[p] == 0xFF && blocks[p + 1] == 0x52) {
+            blocks[p + 10] = 0; // xcb
+            blocks[p + 11] = 0; // ycb
+            break;
+        }
+    }
+
+    // too short for the stream type to be detected
+    const std::vector<uint8_t> truncated(encoded.begin(), encoded.begin() + 3);
+    const std::vector<uint8_t> empty;
+
+    const std::vector<uint8_t>* inputs[] = {&encoded, &crafted, &blocks, &truncated, &empty};
+    const char* labels[] = {"valid", "crafted", "codeblocks", "truncated", "empty"};
+    for(size_t i = 0; i < 5; i++) {
+        J2KDecoder decoder;
+        decoder.setLimits(limits);
+        decoder.setEncodedBytes(inputs[i]->data(), inputs[i]->size());
+
+        timespec start, finish, delta;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+        decoder.decode();
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+        sub_timespec(start, finish, &delta);
+        const double ns = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+        printf("Native-decodeLimits %s %s status=%d %f\n", imageName, labels[i], (int)decoder.getStatus(), ns/1000000.0);
+    }
+}
+
+// Decodes a fixture and a copy truncated to half its size, which openjp2
+// decodes with warnings in non strict mode, and prints the status and what
+// was recorded instead of printed
+void decodeDiagnosticsFile(const char* imageName, size_t iterations = 1) {
+    std::string inPath = "test/fixtures/j2k/";
+    inPath += imageName;
+    inPath += ".j2k";
+    std::vector<uint8_t> encoded;
+    readFile(inPath, encoded);
+    if(encoded.size() < 16) {
+        printf("Native-decodeDiagnostics %s missing\n", imageName);
+        return;
+    }
+
+    std::vector<uint8_t> truncated(encoded.begin(), encoded.begin() + encoded.size() / 2);
+    const std::vector<uint8_t>* inputs[] = {&encoded, &truncated};
+    const char* labels[] = {"complete", "truncated"};
+    for(size_t i = 0; i < 2; i++) {
+        J2KDecoder decoder;
+        decoder.setEncodedBytes(inputs[i]->data(), inputs[i]->size());
+
+        J2KStatus status = J2KStatus::Ok;
+        timespec start, finish, delta;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+        for(size_t j = 0; j < iterations; j++) {
+            status = decoder.decode();
+        }
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+        sub_timespec(start, finish, &delta);
+        const double ns = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+        printf("Native-decodeDiagnostics %s %s status=%d errors=%zu warnings=%zu %f\n", imageName, labels[i],
+            (int)status, decoder.getNumErrors(), decoder.getNumWarnings(), ns/1000000.0/iterations);
+        for(size_t d = 0; d < decoder.getNumDiagnostics(); d++) {
+            const Diagnostic diagnostic = decoder.getDiagnostic(d);
+            printf("  level=%d code=%d %s\n", (int)diagnostic.level, (int)diagnostic.code, diagnostic.message.c_str());
+        }
+    }
+}
+
+void decodeStatisticsFile(const char* imageName, size_t iterations = 1) {
+    std::string inPath = "test/fixtures/j2k/";
+    inPath += imageName;
+    inPath += ".j2k";
+
+    J2KDecoder decoder;
+    std::vector<uint8_t>& encodedBytes = decoder.getEncodedBytes();
+    readFile(inPath, encodedBytes);
+    decoder.setStatistics(true, 256);
+
+    timespec start, finish, delta;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for(int i=0; i < iterations; i++) {
+        decoder.decode();
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double ns = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+    const Statistics statistics = decoder.getStatistics(0);
+    printf("Native-decodeStatistics %s min=%d max=%d %f\n", imageName, statistics.minimum, statistics.maximum, ns/1000000.0);
+}
+
+// Encodes a raw fixture with 256x256 tiles (the checked in j2k fixtures are
+// single tile) and reports the time to the first band and to the whole frame
+void decodeBandsFile(const char* imageName, const FrameInfo frameInfo) {
+    std::string inPath = "test/fixtures/raw/";
+    inPath += imageName;
+    inPath += ".RAW";
+
+    J2KEncoder encoder;
+    std::vector<uint8_t>& rawBytes = encoder.getDecodedBytes(frameInfo);
+    if(!readFile(inPath, rawBytes)) {
+        printf("Native-decodeBands %s missing\n", imageName);
+        return;
+    }
+    encoder.setTileSize(Size(256, 256));
+    encoder.encode();
+
+    J2KDecoder decoder;
+    decoder.getEncodedBytes() = encoder.getEncodedBytes();
+
+    timespec start, first, finish, delta;
+    size_t numBands = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    decoder.decodeBands(0, 0, [&](size_t firstRow, size_t numRows) {
+        if(numBands++ == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &first);
+        }
+        return true;
+    });
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    if(numBands == 0) {
+        first = finish;
+    }
+    sub_timespec(start, first, &delta);
+    const double firstNs = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+    sub_timespec(start, finish, &delta);
+    const double ns = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+
+    // returning false stops the decode after the first band
+    size_t numStopped = 0;
+    decoder.decodeBands(0, 0, [&](size_t firstRow, size_t numRows) {
+        numStopped++;
+        return false;
+    });
+    printf("Native-decodeBands %s bands=%zu first=%f total=%f stopped=%zu status=%d\n", imageName, numBands,
+        firstNs/1000000.0, ns/1000000.0, numStopped, (int)decoder.getStatus());
+}
+
+void decodeProgressiveFile(const char* imageName, size_t previewLevel, size_t iterations = 1) {
+    std::string inPath = "test/fixtures/j2k/";
+    inPath += imageName;
+    inPath += ".j2k";
+
+    J2KDecoder decoder;
+    std::vector<uint8_t>& encodedBytes = decoder.getEncodedBytes();
+    readFile(inPath, encodedBytes);
+
+    // preview then full resolution, restarting vs refining the session
+    timespec start, finish, delta;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for(int i=0; i < iterations; i++) {
+        decoder.decodeSubResolution(previewLevel, 0);
+        decoder.decode();
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double restartNs = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for(int i=0; i < iterations; i++) {
+        decoder.beginProgressiveDecode(0);
+        decoder.decodeProgressive(previewLevel);
+        decoder.decodeProgressive(0);
+        decoder.endProgressiveDecode();
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double ns = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+    printf("Native-decodeProgressive %s restart=%f session=%f\n", imageName, restartNs/1000000.0, ns/1000000.0);
+}
+
+void decodePyramidFile(const char* imageName, size_t iterations = 1) {
+    std::string inPath = "test/fixtures/j2k/";
+    inPath += imageName;
+    inPath += ".j2k";
+
+    J2KDecoder decoder;
+    std::vector<uint8_t>& encodedBytes = decoder.getEncodedBytes();
+    readFile(inPath, encodedBytes);
+    decoder.decode();
+    const size_t numDecompositions = decoder.getNumDecompositions();
+
+    // one decodeSubResolution() per level vs decodePyramid()
+    timespec start, finish, delta;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for(int i=0; i < iterations; i++) {
+        for(size_t level=0; level <= numDecompositions; level++) {
+            decoder.decodeSubResolution(level, 0);
+        }
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double levelsNs = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for(int i=0; i < iterations; i++) {
+        decoder.decodePyramid(0);
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double ns = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+    printf("Native-decodePyramid %s levels=%zu perLevel=%f pyramid=%f\n", imageName, numDecompositions + 1, levelsNs/1000000.0, ns/1000000.0);
+}
+
+void estimateFile(const char* imageName, size_t decompositionLevel) {
+    std::string inPath = "test/fixtures/j2k/";
+    inPath += imageName;
+    inPath += ".j2k";
+
+    J2KDecoder decoder;
+    std::vector<uint8_t>& encodedBytes = decoder.getEncodedBytes();
+    if(!readFile(inPath, encodedBytes)) {
+        printf("Native-estimate %s missing\n", imageName);
+        return;
+    }
+    decoder.readHeader();
+    const Estimate decode = decoder.estimateDecode(decompositionLevel, Size(), 0);
+
+    J2KEncoder encoder;
+    const Estimate encode = encoder.estimateEncode(decoder.getFrameInfo());
+    printf("Native-estimate %s level=%zu decodeBytes=%zu decodeCost=%f encodeBytes=%zu encodeCost=%f\n", imageName,
+        decompositionLevel, decode.totalBytes, decode.cost, encode.totalBytes, encode.cost);
+}
+
+// Estimates first and then second with the same decoder, the way an
+// admission check reuses one, and checks the second estimate matches a
+// fresh decoder's
+void estimateReuseFile(const char* firstName, const char* secondName) {
+    std::vector<uint8_t> first, second;
+    if(!readFile(std::string("test/fixtures/j2k/") + firstName + ".j2k", first) ||
+       !readFile(std::string("test/fixtures/j2k/") + secondName + ".j2k", second)) {
+        printf("Native-estimateReuse %s %s missing\n", firstName, secondName);
+        return;
+    }
+    J2KDecoder reused;
+    reused.setEncodedBytes(first.data(), first.size());
+    reused.estimateDecode(0, Size(), 0);
+    reused.setEncodedBytes(second.data(), second.size());
+    const Estimate estimate = reused.estimateDecode(0, Size(), 0);
+
+    J2KDecoder fresh;
+    fresh.setEncodedBytes(second.data(), second.size());
+    const Estimate expected = fresh.estimateDecode(0, Size(), 0);
+    printf("Native-estimateReuse %s %s decodedBytes=%zu matches=%d\n", firstName, secondName, estimate.decodedBytes,
+        estimate.decodedBytes == expected.decodedBytes && estimate.totalBytes == expected.totalBytes);
+}
+
+void transcodeFile(const char* imageName, size_t iterations = 1) {
+    std::string inPath = "test/fixtures/j2k/";
+    inPath += imageName;
+    inPath += ".j2k";
+
+    J2KDecoder decoder;
+    std::vector<uint8_t>& encodedBytes = decoder.getEncodedBytes();
+    readFile(inPath, encodedBytes);
+
+    // lossy derivative at 10:1
+    J2KEncoder encoder;
+    encoder.setQuality(false, 1);
+    encoder.setCompressionRatio(0, 10);
+
+    J2KTranscoder transcoder;
+
+    timespec start, finish, delta;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    for(int i=0; i < iterations; i++) {
+        transcoder.transcode(decoder, encoder, 0, 0);
+    }
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double ns = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+    printf("Native-transcode %s %f\n", imageName, ns/1000000.0);
+}
+
+void appendUint32(std::vector<uint8_t>& vec, uint32_t value) {
+    for(int i=0; i < 4; i++) {
+        vec.push_back((value >> (i * 8)) & 0xFF);
+    }
+}
+
+void appendItem(std::vector<uint8_t>& vec, const std::vector<uint8_t>& value) {
+    appendUint32(vec, 0xE000FFFE);
+    appendUint32(vec, value.size());
+    vec.insert(vec.end(), value.begin(), value.end());
+}
+
+void encapsulatedFile(const char* imageName, size_t numFrames, size_t frame) {
+    std::string inPath = "test/fixtures/j2k/";
+    inPath += imageName;
+    inPath += ".j2k";
+    std::vector<uint8_t> encoded;
+    readFile(inPath, encoded);
+    if(encoded.size() & 1) {
+        encoded.push_back(0);
+    }
+
+    // multi-frame encapsulated pixel data with a Basic Offset Table
+    std::vector<uint8_t> botBytes;
+    for(size_t i=0; i < numFrames; i++) {
+        appendUint32(botBytes, i * (encoded.size() + 8));
+    }
+    std::vector<uint8_t> pixelData;
+    appendItem(pixelData, botBytes);
+    for(size_t i=0; i < numFrames; i++) {
+        appendItem(pixelData, encoded);
+    }
+    appendUint32(pixelData, 0xE0DDFFFE);
+    appendUint32(pixelData, 0);
+    char path[] = "/tmp/openjpegjs-encapsulated-XXXXXX";
+    const int fd = mkstemp(path);
+    if(fd < 0) {
+        return;
+    }
+    ::close(fd);
+    writeFile(path, pixelData);
+
+    timespec start, finish, delta;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+
+    EncapsulatedFrameReader reader;
+    J2KDecoder decoder;
+    if(reader.open(path) && reader.setFrame(decoder, frame)) {
+        decoder.decode();
+    }
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    sub_timespec(start, finish, &delta);
+    const double ns = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
+    printf("Native-encapsulated %s frame %zu of %zu %f%s%s\n", imageName, frame, reader.getNumFrames(), ns/1000000.0,
+      reader.getNumErrors() ? " " : "", reader.getNumErrors() ? reader.getDiagnostic(0).message.c_str() : "");
+    unlink(path);
+}
+
 int main(int argc, char** argv) {
   const size_t iterations = (argc > 1) ? atoi(argv[1]) : 1;
   encodeFile("CT1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, iterations);
@@ -157,5 +845,70 @@ int main(int argc, char** argv) {
   decodeFile("VL6", iterations);
   decodeFile("XA1", iterations);
 
+  encodeTargetFile("CT1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, 25000, 0);
+  encodeTargetFile("CT1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, 0, 50);
+  encodeTargetFile("XA1", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false}, 100000, 0);
+  encodeTargetFile("XA1", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false}, 0, 50);
+
+  measurePSNRFile("CT1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true});
+  measurePSNRFile("XA1", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false});
+
+  autoBitDepthFile("CT1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, iterations);
+  autoBitDepthFile("MR1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, iterations);
+  autoBitDepthFile("XA1", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false}, iterations);
+  autoBitDepthSigned8File("CT1", {.width = 512, .height = 512, .bitsPerSample = 8, .componentCount = 1, .isSigned = true}, iterations);
+
+  volumeFile("CT1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, 8, iterations);
+  volumeFile("MR1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, 7, iterations);
+  volumeSigned8File("CT1", {.width = 512, .height = 512, .bitsPerSample = 8, .componentCount = 1, .isSigned = true}, 8, iterations);
+
+  decodeHighThroughputFile("CT1", iterations);
+  decodeHighThroughputFile("MR1", iterations);
+  decodeHighThroughputFile("NM1", iterations);
+  decodeHighThroughputFile("XA1", iterations);
+
+  decodeLimitsFile("CT1");
+  decodeLimitsFile("XA1");
+
+  decodeDiagnosticsFile("CT1", iterations);
+  decodeDiagnosticsFile("RG2", iterations);
+
+  decodeBudgetFile("CT1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true});
+  decodeBudgetFile("XA1", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false});
+
+  subsampledFile("US1", {.width = 640, .height = 480, .bitsPerSample = 8, .componentCount = 3, .isSigned = false}, iterations);
+  subsampledFile("VL1", {.width = 756, .height = 486, .bitsPerSample = 8, .componentCount = 3, .isSigned = false}, iterations);
+
+  decodeStatisticsFile("CT1", iterations);
+  decodeStatisticsFile("MR1", iterations);
+  decodeStatisticsFile("RG2", iterations);
+
+  decodeBandsFile("CT1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true});
+  decodeBandsFile("XA1", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false});
+
+  decodeProgressiveFile("CT1", 3, iterations);
+  decodeProgressiveFile("RG2", 3, iterations);
+  decodeProgressiveFile("SC1", 3, iterations);
+
+  decodePyramidFile("RG2", iterations);
+  decodePyramidFile("SC1", iterations);
+
+  estimateFile("CT1", 0);
+  estimateFile("RG2", 0);
+  estimateFile("RG2", 2);
+  estimateFile("SC1", 0);
+
+  estimateReuseFile("CT1", "XA1");
+  estimateReuseFile("XA1", "US1");
+
+  transcodeFile("CT1", iterations);
+  transcodeFile("MR2", iterations);
+  transcodeFile("NM1", iterations);
+  transcodeFile("RG2", iterations);
+  transcodeFile("US1", iterations);
+  transcodeFile("XA1", iterations);
+
+  encapsulatedFile("XA1", 300, 250);
+
   return 0;
 }
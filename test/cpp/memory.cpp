@@ -0,0 +1,221 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Reports the memory used by decode and encode for each fixture: the peak
+// resident set size (VmHWM, reset before each operation), the peak heap
+// in use above what was live before the operation, the number and total
+// bytes of allocations, and the ratio of the peak heap to the image size.
+// Allocations are counted by interposing the glibc malloc family, so this
+// includes openjp2's allocations as well as ours.  Pass fixture names to
+// limit the run, e.g. memorybench CT1 XA1
+
+#include <atomic>
+#include <errno.h>
+#include <string>
+#include <vector>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../src/J2KDecoder.hpp"
+#include "../../src/J2KEncoder.hpp"
+#include "util.hpp"
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+static std::atomic<size_t> allocations(0);
+static std::atomic<size_t> allocatedBytes(0);
+static std::atomic<size_t> liveBytes(0);
+static std::atomic<size_t> peakBytes(0);
+
+static void* track(void* ptr) {
+  if(ptr) {
+    const size_t size = malloc_usable_size(ptr);
+    allocations++;
+    allocatedBytes += size;
+    const size_t live = liveBytes += size;
+    size_t peak = peakBytes;
+    while(live > peak && !peakBytes.compare_exchange_weak(peak, live)) {
+    }
+  }
+  return ptr;
+}
+
+static void untrack(void* ptr) {
+  if(ptr) {
+    liveBytes -= malloc_usable_size(ptr);
+  }
+}
+
+extern "C" {
+void* malloc(size_t size) {
+  return track(__libc_malloc(size));
+}
+
+void* calloc(size_t count, size_t size) {
+  return track(__libc_calloc(count, size));
+}
+
+void* realloc(void* ptr, size_t size) {
+  untrack(ptr);
+  void* result = __libc_realloc(ptr, size);
+  if(!result && size) {
+    // the original block is still allocated
+    liveBytes += ptr ? malloc_usable_size(ptr) : 0;
+    return NULL;
+  }
+  return track(result);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  return track(__libc_memalign(alignment, size));
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  return track(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+  void* result = track(__libc_memalign(alignment, size));
+  if(!result) {
+    return ENOMEM;
+  }
+  *ptr = result;
+  return 0;
+}
+
+void free(void* ptr) {
+  untrack(ptr);
+  __libc_free(ptr);
+}
+}
+
+struct Fixture {
+    const char* name;
+    FrameInfo frameInfo;
+};
+
+static const Fixture fixtures[] = {
+  {"CT1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}},
+  {"CT2", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}},
+  {"MR1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}},
+  {"MR2", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false}},
+  {"NM1", {.width = 256, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}},
+  {"US1", {.width = 640, .height = 480, .bitsPerSample = 8, .componentCount = 3, .isSigned = false}},
+  {"XA1", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false}},
+};
+
+// VmHWM/VmRSS from /proc/self/status in bytes, 0 if unavailable
+size_t readStatus(const char* field) {
+  FILE* file = fopen("/proc/self/status", "r");
+  if(!file) {
+    return 0;
+  }
+  char line[256];
+  size_t kb = 0;
+  const size_t length = strlen(field);
+  while(fgets(line, sizeof(line), file)) {
+    if(strncmp(line, field, length) == 0 && line[length] == ':') {
+      kb = strtoul(line + length + 1, NULL, 10);
+      break;
+    }
+  }
+  fclose(file);
+  return kb * 1024;
+}
+
+// resets VmHWM to the current RSS so the next reading is the peak of the
+// following operation (Linux 4.0+)
+bool resetPeakRSS() {
+  FILE* file = fopen("/proc/self/clear_refs", "w");
+  if(!file) {
+    return false;
+  }
+  const bool result = fputs("5", file) >= 0;
+  return (fclose(file) == 0) && result;
+}
+
+struct Measurement {
+  size_t rssBase;
+  size_t heapBase;
+  size_t allocations;
+  size_t allocatedBytes;
+  bool rssReset;
+};
+
+Measurement begin() {
+  Measurement m;
+  m.rssReset = resetPeakRSS();
+  m.rssBase = readStatus("VmRSS");
+  m.heapBase = liveBytes;
+  peakBytes = m.heapBase;
+  m.allocations = allocations;
+  m.allocatedBytes = allocatedBytes;
+  return m;
+}
+
+void report(const char* operation, const char* name, const Measurement& m, size_t imageBytes) {
+  const size_t peakRSS = readStatus("VmHWM");
+  const size_t rss = (m.rssReset && peakRSS > m.rssBase) ? peakRSS - m.rssBase : 0;
+  const size_t heap = peakBytes - m.heapBase;
+  printf("Native-memory-%s %s peakRSS=%zu peakRSSDelta=%zu peakHeap=%zu allocations=%zu allocatedBytes=%zu imageBytes=%zu ratio=%f\n",
+    operation, name, peakRSS, rss, heap, allocations - m.allocations, allocatedBytes - m.allocatedBytes, imageBytes,
+    imageBytes ? (double)heap / imageBytes : 0.0);
+}
+
+void decode(const Fixture& fixture) {
+  std::string path = "test/fixtures/j2k/";
+  path += fixture.name;
+  path += ".j2k";
+  std::vector<uint8_t> encoded;
+  readFile(path, encoded);
+  if(encoded.empty()) {
+    printf("Native-memory-decode %s missing\n", fixture.name);
+    return;
+  }
+
+  J2KDecoder decoder;
+  decoder.setEncodedBytes(encoded.data(), encoded.size());
+  const Measurement m = begin();
+  decoder.decode();
+  report("decode", fixture.name, m, decoder.getDecodedBytes().size());
+}
+
+void encode(const Fixture& fixture) {
+  std::string path = "test/fixtures/raw/";
+  path += fixture.name;
+  path += ".RAW";
+  std::vector<uint8_t> raw;
+  readFile(path, raw);
+  if(raw.empty()) {
+    printf("Native-memory-encode %s missing\n", fixture.name);
+    return;
+  }
+
+  J2KEncoder encoder;
+  encoder.setDecodedBytes(raw.data(), raw.size(), fixture.frameInfo);
+  const Measurement m = begin();
+  encoder.encode();
+  report("encode", fixture.name, m, raw.size());
+}
+
+int main(int argc, char** argv) {
+  for(const Fixture& fixture : fixtures) {
+    bool selected = argc < 2;
+    for(int i = 1; i < argc; i++) {
+      selected = selected || std::string(argv[i]) == fixture.name;
+    }
+    if(selected) {
+      decode(fixture);
+      encode(fixture);
+    }
+  }
+  return 0;
+}
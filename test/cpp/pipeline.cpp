@@ -0,0 +1,98 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Measures EncodePipeline ingest throughput (frames/s and raw MB/s) for an
+// increasing number of threads.  The frames are the raw fixtures repeated,
+// each submitted as a copy like frames arriving from the network.  Usage:
+// pipelinebench [frames] [maxInFlightMB]
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../../src/EncodePipeline.hpp"
+#include "util.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Fixture {
+    const char* name;
+    FrameInfo frameInfo;
+};
+
+static const Fixture fixtures[] = {
+  {"CT1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}},
+  {"CT2", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}},
+  {"MR1", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}},
+  {"MR2", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false}},
+  {"NM1", {.width = 256, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}},
+  {"US1", {.width = 640, .height = 480, .bitsPerSample = 8, .componentCount = 3, .isSigned = false}},
+  {"XA1", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false}},
+};
+
+void ingest(const std::vector<std::vector<uint8_t>>& raw, const std::vector<FrameInfo>& frameInfos,
+            size_t numFrames, size_t numThreads, size_t maxInFlightBytes) {
+  size_t rawBytes = 0;
+  size_t encodedBytes = 0;
+  size_t nextExpected = 0;
+  size_t outOfOrder = 0;
+  size_t failed = 0;
+  size_t peakInFlight = 0;
+
+  const Clock::time_point start = Clock::now();
+  {
+    EncodePipeline pipeline(numThreads, maxInFlightBytes, maxInFlightBytes / 4,
+      [&](size_t frame, const std::vector<uint8_t>& encoded, J2KStatus status) {
+        outOfOrder += (frame != nextExpected);
+        nextExpected = frame + 1;
+        failed += (status != J2KStatus::Ok);
+        encodedBytes += encoded.size();
+      });
+    for(size_t i = 0; i < numFrames; i++) {
+      const size_t fixture = i % raw.size();
+      std::vector<uint8_t> frame(raw[fixture]);
+      rawBytes += frame.size();
+      pipeline.submit(std::move(frame), frameInfos[fixture]);
+      peakInFlight = std::max(peakInFlight, pipeline.getRawBytesInFlight() + pipeline.getEncodedBytesInFlight());
+    }
+    pipeline.wait();
+  }
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  printf("Native-pipeline threads=%zu frames=%zu seconds=%f frames/s=%f MB/s=%f ratio=%f peakInFlightMB=%f outOfOrder=%zu failed=%zu\n",
+    numThreads, numFrames, seconds, numFrames / seconds, rawBytes / seconds / 1000000.0,
+    encodedBytes ? (double)rawBytes / encodedBytes : 0.0, peakInFlight / 1000000.0, outOfOrder, failed);
+}
+
+int main(int argc, char** argv) {
+  const size_t numFrames = (argc > 1) ? atoi(argv[1]) : 200;
+  const size_t maxInFlightBytes = ((argc > 2) ? atoi(argv[2]) : 64) * 1000000;
+
+  std::vector<std::vector<uint8_t>> raw;
+  std::vector<FrameInfo> frameInfos;
+  for(const Fixture& fixture : fixtures) {
+    std::string path = "test/fixtures/raw/";
+    path += fixture.name;
+    path += ".RAW";
+    std::vector<uint8_t> bytes;
+    readFile(path, bytes);
+    if(!bytes.empty()) {
+      raw.push_back(bytes);
+      frameInfos.push_back(fixture.frameInfo);
+    }
+  }
+  if(raw.empty()) {
+    printf("Native-pipeline fixtures missing\n");
+    return 1;
+  }
+
+  const size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  for(size_t numThreads = 1; ; numThreads = std::min(numThreads * 2, maxThreads)) {
+    ingest(raw, frameInfos, numFrames, numThreads, maxInFlightBytes);
+    if(numThreads == maxThreads) {
+      break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Measures time-to-visible-frame for DecodeScheduler under a simulated
+// scroll through a series: all frames are queued as prefetch, then the
+// visible frame moves forward at a fixed rate.  In "priority" mode the
+// visible frame and its neighbours are reprioritized as the user scrolls,
+// in "fifo" mode they are left in submission order for comparison.
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../../src/DecodeScheduler.hpp"
+#include "util.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+static const char* fixtures[] = {
+  "CT1", "CT2", "MR1", "MR2", "MR3", "MR4", "NM1", "RG2", "RG3", "SC1", "XA1"
+};
+
+double percentile(std::vector<double> values, double p) {
+  if(values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+void scroll(const char* mode, const std::vector<std::vector<uint8_t>>& frames, size_t numThreads,
+            size_t numSteps, size_t framesPerStep, double stepMS) {
+  const bool prioritize = std::string(mode) == "priority";
+  std::mutex mutex;
+  std::vector<Clock::time_point> done(frames.size());
+  std::vector<bool> isDone(frames.size(), false);
+  std::vector<size_t> jobIds(frames.size());
+
+  DecodeScheduler scheduler(numThreads);
+  const Clock::time_point begin = Clock::now();
+  for(size_t i = 0; i < frames.size(); i++) {
+    jobIds[i] = scheduler.submit(frames[i].data(), frames[i].size(), 0, DecodePriority::Prefetch,
+      [&, i](size_t, J2KDecoder& decoder) {
+        if(decoder.getStatus() != J2KStatus::Ok) {
+          return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        done[i] = Clock::now();
+        isDone[i] = true;
+      });
+  }
+
+  std::vector<size_t> visibleFrames;
+  std::vector<Clock::time_point> visibleAt;
+  for(size_t step = 0; step < numSteps; step++) {
+    const size_t visible = std::min(frames.size() - 1, step * framesPerStep);
+    visibleFrames.push_back(visible);
+    visibleAt.push_back(Clock::now());
+    if(prioritize) {
+      // previously visible/adjacent frames go back to prefetch
+      if(step > 0) {
+        const size_t previous = visibleFrames[step - 1];
+        for(size_t i = previous > 2 ? previous - 2 : 0; i <= std::min(frames.size() - 1, previous + 2); i++) {
+          scheduler.setPriority(jobIds[i], DecodePriority::Prefetch);
+        }
+      }
+      for(size_t i = visible > 2 ? visible - 2 : 0; i <= std::min(frames.size() - 1, visible + 2); i++) {
+        scheduler.setPriority(jobIds[i], DecodePriority::Adjacent);
+      }
+      scheduler.setPriority(jobIds[visible], DecodePriority::Visible);
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(stepMS));
+  }
+  scheduler.wait();
+  const double totalMS = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+
+  std::vector<double> latencies;
+  for(size_t step = 0; step < visibleFrames.size(); step++) {
+    const size_t frame = visibleFrames[step];
+    const double ms = isDone[frame] ? std::chrono::duration<double, std::milli>(done[frame] - visibleAt[step]).count() : totalMS;
+    latencies.push_back(std::max(0.0, ms));
+  }
+  printf("Native-scheduler-%s threads=%zu p50=%f p95=%f max=%f total=%f preemptions=%zu\n", mode, numThreads,
+    percentile(latencies, 0.5), percentile(latencies, 0.95), percentile(latencies, 1.0), totalMS,
+    scheduler.getNumPreemptions());
+}
+
+int main(int argc, char** argv) {
+  const size_t numThreads = (argc > 1) ? atoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+  const size_t numFrames = (argc > 2) ? atoi(argv[2]) : 300;
+  const size_t numFixtures = sizeof(fixtures) / sizeof(fixtures[0]);
+
+  // a series made of the fixtures repeated
+  std::vector<std::vector<uint8_t>> encoded(numFixtures);
+  for(size_t i = 0; i < numFixtures; i++) {
+    std::string path = "test/fixtures/j2k/";
+    path += fixtures[i];
+    path += ".j2k";
+    readFile(path, encoded[i]);
+  }
+  std::vector<std::vector<uint8_t>> frames(numFrames);
+  for(size_t i = 0; i < numFrames; i++) {
+    frames[i] = encoded[i % numFixtures];
+  }
+
+  // scroll 3 frames every 30ms through the first half of the series
+  const size_t framesPerStep = 3;
+  const size_t numSteps = numFrames / 2 / framesPerStep;
+  scroll("fifo", frames, numThreads, numSteps, framesPerStep, 30);
+  scroll("priority", frames, numThreads, numSteps, framesPerStep, 30);
+
+  return 0;
+}
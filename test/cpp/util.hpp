@@ -0,0 +1,65 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <iterator>
+#include <string>
+#include <time.h>
+#include <stdint.h>
+
+// returns false and leaves vec unchanged if the file can't be opened (e.g. a
+// fixture that is not checked in)
+bool readFile(std::string fileName, std::vector<uint8_t>& vec) {
+    // open the file:
+    std::ifstream file(fileName, std::ios::in | std::ios::binary);
+    if(!file) {
+        return false;
+    }
+    // Stop eating new lines in binary mode!!!
+    file.unsetf(std::ios::skipws);
+
+    // get its size:
+    std::streampos fileSize;
+    file.seekg(0, std::ios::end);
+    fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    // reserve capacity
+    vec.reserve(fileSize);
+
+    // read the data:
+    vec.insert(vec.begin(),
+                std::istream_iterator<uint8_t>(file),
+                std::istream_iterator<uint8_t>());
+
+    //std::istreambuf_iterator iter(file);
+    //std::copy(iter.begin(), iter.end(), std::back_inserter(vec));
+    return true;
+}
+
+void writeFile(std::string fileName, const std::vector<uint8_t>& vec) {
+    std::ofstream file(fileName, std::ios::out | std::ofstream::binary);
+    std::copy(vec.begin(), vec.end(), std::ostreambuf_iterator<char>(file));
+}
+
+enum { NS_PER_SECOND = 1000000000 };
+
+void sub_timespec(struct timespec t1, struct timespec t2, struct timespec *td)
+{
+    td->tv_nsec = t2.tv_nsec - t1.tv_nsec;
+    td->tv_sec  = t2.tv_sec - t1.tv_sec;
+    if (td->tv_sec > 0 && td->tv_nsec < 0)
+    {
+        td->tv_nsec += NS_PER_SECOND;
+        td->tv_sec--;
+    }
+    else if (td->tv_sec < 0 && td->tv_nsec > 0)
+    {
+        td->tv_nsec -= NS_PER_SECOND;
+        td->tv_sec++;
+    }
+}
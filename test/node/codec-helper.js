@@ -21,6 +21,58 @@ function decode(decoder, encodedBitStream, iterations=1) {
 }
 
 
+// Per frame time of the individual call sequence (copy in, decode, frame
+// info, pixel data and the other getters) and of one decodeFrame() call on
+// the same frame.  Both paths are run warmupIterations times first so JIT
+// compilation and the first allocations are not part of either time.
+function decodeFrame(decoder, encodedBitStream, iterations=1, warmupIterations=0) {
+    const calls = () => {
+      const encodedBuffer = decoder.getEncodedBuffer(encodedBitStream.length)
+      encodedBuffer.set(encodedBitStream)
+      decoder.decode()
+      decoder.getStatus()
+      decoder.getFrameInfo()
+      decoder.getDecodedBuffer()
+      decoder.getNumDecompositions()
+      decoder.getIsReversible()
+      decoder.getIsHighThroughput()
+      decoder.getProgressionOrder()
+      decoder.getImageOffset()
+      decoder.getTileSize()
+      decoder.getTileOffset()
+      decoder.getBlockDimensions()
+      decoder.getNumLayers()
+      decoder.getColorSpace()
+    }
+    const frame = () => decoder.decodeFrame(encodedBitStream, {decompositionLevel: 0, decodeLayer: 0})
+
+    for(let i=0; i < warmupIterations; i++) {
+      calls()
+      frame()
+    }
+
+    const beginCalls = process.hrtime();
+    for(let i=0; i < iterations; i++) {
+      calls()
+    }
+    const callsDuration = process.hrtime(beginCalls);
+
+    let result
+    const beginFrame = process.hrtime();
+    for(let i=0; i < iterations; i++) {
+      result = frame()
+    }
+    const frameDuration = process.hrtime(beginFrame);
+
+    const toMS = (duration) => (duration[0] * 1000 + duration[1] / 1000000) / iterations
+    return {
+      result,
+      callsTimeMS: toMS(callsDuration),
+      decodeFrameTimeMS: toMS(frameDuration)
+    }
+}
+
+
 function encode(encoder, uncompressedImageFrame, imageFrame, iterations = 1) {
   const decodedBytes = encoder.getDecodedBuffer(imageFrame);
   decodedBytes.set(uncompressedImageFrame);
@@ -43,5 +95,6 @@ function encode(encoder, uncompressedImageFrame, imageFrame, iterations = 1) {
 
 module.exports = {
     decode,
+    decodeFrame,
     encode
 }
\ No newline at end of file
@@ -1,33 +1,165 @@
 // Copyright (c) Chris Hafey.
 // SPDX-License-Identifier: MIT
 
-let openjpegjs = require('../../dist/openjpegjs.js');
 const codecHelper = require('./codec-helper.js')
 const fs = require('fs')
 
+// OPENJPEGJS_BACKEND=native runs against the native addon built by
+// scripts/node-addon-build.sh instead of the WASM build in dist,
+// OPENJPEGJS_BACKEND=wasm-decoder against the decoder-only WASM build
+const backend = process.env.OPENJPEGJS_BACKEND || 'wasm'
+const labels = {native: 'Addon', wasm: 'WASM', 'wasm-decoder': 'WASM-decoder'}
+const label = labels[backend]
+
+// OPENJPEGJS_MEMORY=1 also reports the peak WASM heap in use, the number
+// and bytes of allocations and the WASM heap size of each decode/encode (or
+// the peak RSS of the process for the native addon) and the ratio of the
+// peak to the image size.  The WASM numbers come from openjpegjs-memory, a
+// build of the full module that counts its allocations.
+const reportMemory = !!process.env.OPENJPEGJS_MEMORY
+
+function elapsedMS(begin) {
+  const duration = process.hrtime(begin)
+  return duration[0] * 1000 + duration[1] / 1000000
+}
+
+// reports the .wasm size, the time to compile it and the time until the
+// module is ready to use (instantiate + runtime init).  The module compiled
+// here is the one instantiated so the .wasm is only compiled once.
+function loadWasm(name) {
+  const wasmPath = '../../dist/' + name + '.wasm'
+  if(!fs.existsSync(wasmPath)) {
+    return Promise.reject(new Error(wasmPath + ' not found, build it with scripts/wasm-build.sh'))
+  }
+  const wasm = fs.readFileSync(wasmPath)
+  const beginCompile = process.hrtime()
+  return WebAssembly.compile(wasm).then(function(module) {
+    const compileMS = elapsedMS(beginCompile)
+    const beginInstantiate = process.hrtime()
+    return require('../../dist/' + name + '.js')({
+      instantiateWasm: function(imports, receiveInstance) {
+        WebAssembly.instantiate(module, imports).then(function(instance) {
+          receiveInstance(instance, module)
+        })
+        return {}
+      }
+    }).then(function(openjpeg) {
+      console.log(label + "-startup  " + name + ".wasm bytes=" + wasm.length + " compile=" + compileMS + " ready=" + elapsedMS(beginInstantiate))
+      return openjpeg
+    })
+  })
+}
+
+// called before each operation memory() reports on
+function memoryBegin(openjpeg) {
+  if(reportMemory && openjpeg.resetMemoryStats) {
+    openjpeg.resetMemoryStats()
+  }
+}
+
+function memory(openjpeg, operation, imageName, imageBytes) {
+  if(!reportMemory) {
+    return
+  }
+  if(!openjpeg.getMemoryStats) {
+    const peak = process.resourceUsage().maxRSS * 1024
+    console.log(label + "-memory-" + operation + " " + imageName + " peakRSS=" + peak + " imageBytes=" + imageBytes + " ratio=" + (peak / imageBytes))
+    return
+  }
+  const stats = openjpeg.getMemoryStats()
+  console.log(label + "-memory-" + operation + " " + imageName + " peakHeap=" + stats.peakBytes + " allocations=" + stats.allocations +
+    " allocatedBytes=" + stats.allocatedBytes + " heapSize=" + openjpeg.getHeapSize() + " imageBytes=" + imageBytes +
+    " ratio=" + (stats.peakBytes / imageBytes))
+}
+
+function loadOpenJPEG() {
+  if(backend === 'native') {
+    return Promise.resolve(require('../../build-node/openjpegjs.node'))
+  }
+  if(backend === 'wasm-decoder') {
+    return loadWasm('openjpegjs-decoder')
+  }
+  return loadWasm(reportMemory ? 'openjpegjs-memory' : 'openjpegjs')
+}
+
 function decodeFile(openjpeg, imageName, iterations = 1) {
   const encodedImagePath = '../fixtures/j2k/' + imageName + ".j2k"
+  if(!fs.existsSync(encodedImagePath)) {
+    console.log(label + "-decode   " + imageName + " missing")
+    return
+  }
   encodedBitStream = fs.readFileSync(encodedImagePath)
   const decoder = new openjpeg.J2KDecoder()
+  memoryBegin(openjpeg)
   const result = codecHelper.decode(decoder, encodedBitStream, iterations)
-  console.log("WASM-decode   " + imageName + " " +  result.decodeTimeMS);
+  console.log(label + "-decode   " + imageName + " " +  result.decodeTimeMS);
+  memory(openjpeg, "decode", imageName, result.pixels.length)
   decoder.delete();
   return result
 }
 
 function encodeFile(openjpeg, imageName, imageFrame, iterations = 1) {
   const pathToUncompressedImageFrame = '../fixtures/raw/' + imageName + ".RAW"
+  if(!fs.existsSync(pathToUncompressedImageFrame)) {
+    console.log(label + "-encode   " + imageName + " missing")
+    return
+  }
   const uncompressedImageFrame = fs.readFileSync(pathToUncompressedImageFrame);
   const encoder = new openjpeg.J2KEncoder();
   //encoder.setQuality(false, 0.001);
+  memoryBegin(openjpeg)
   const result = codecHelper.encode(encoder, uncompressedImageFrame, imageFrame, iterations)
-  console.log("WASM-encode   " + imageName + " " +  result.encodeTimeMS);
+  console.log(label + "-encode   " + imageName + " " +  result.encodeTimeMS);
+  memory(openjpeg, "encode", imageName, uncompressedImageFrame.length)
   encoder.delete();
   return result
 }
 
+// Compares the call sequence with the one call decodeFrame() API on the same
+// frame, the difference is the cost of the extra calls.  It only shows on
+// small frames, so a 32x32 crop of CT1 is encoded and decoded many times.
+function decodeFrameTiny(openjpeg, iterations) {
+  const size = 32
+  const name = 'CT1 ' + size + 'x' + size
+  if(!openjpeg.J2KEncoder) {
+    console.log(label + "-decodeFrame " + name + " skipped, no encoder in this module")
+    return
+  }
+  const decoder = new openjpeg.J2KDecoder()
+  if(!decoder.decodeFrame) {
+    console.log(label + "-decodeFrame " + name + " skipped, decodeFrame() is not in this module (rebuild it)")
+    decoder.delete();
+    return
+  }
+
+  // CT1 is 512x512 16 bit signed little endian
+  const raw = fs.readFileSync('../fixtures/raw/CT1.RAW')
+  const crop = new Uint8Array(size * size * 2)
+  for(let y=0; y < size; y++) {
+    const row = ((256 + y) * 512 + 256) * 2
+    crop.set(raw.subarray(row, row + size * 2), y * size * 2)
+  }
+  const encoder = new openjpeg.J2KEncoder()
+  const encoded = codecHelper.encode(encoder, crop, {width: size, height: size, bitsPerSample: 16, componentCount: 1, isSigned: true})
+  const encodedBitStream = Uint8Array.from(encoded.encodedBytes)
+  encoder.delete();
+
+  const result = codecHelper.decodeFrame(decoder, encodedBitStream, Math.max(iterations, 2000), 200)
+  console.log(label + "-decodeFrame " + name + " calls=" + result.callsTimeMS + " decodeFrame=" + result.decodeFrameTimeMS +
+    " saved=" + (result.callsTimeMS - result.decodeFrameTimeMS))
+  decoder.delete();
+}
+
 function main(openjpeg) {
   const iterations = (process.argv.length > 2) ? parseInt(process.argv[2]) : 1
+  if(openjpeg.J2KEncoder) {
+    encodeAll(openjpeg, iterations)
+  }
+  decodeAll(openjpeg, iterations)
+  decodeFrameTiny(openjpeg, iterations)
+}
+
+function encodeAll(openjpeg, iterations) {
   encodeFile(openjpeg, 'CT1', {width: 512, height: 512, bitsPerSample: 16, componentCount: 1, isSigned: true}, iterations)
   encodeFile(openjpeg, 'CT2', {width: 512, height: 512, bitsPerSample: 16, componentCount: 1, isSigned: true}, iterations);
   encodeFile(openjpeg, 'MG1', {width: 3064, height: 4774, bitsPerSample: 16, componentCount: 1, isSigned: false}, iterations);
@@ -41,6 +173,9 @@ function main(openjpeg) {
   encodeFile(openjpeg, 'RG3', {width: 1760, height: 1760, bitsPerSample: 16, componentCount: 1, isSigned: false}, iterations);
   encodeFile(openjpeg, 'SC1', {width: 2048, height: 2487, bitsPerSample: 16, componentCount: 1, isSigned: false}, iterations);
   encodeFile(openjpeg, 'XA1', {width: 1024, height: 1024, bitsPerSample: 16, componentCount: 1, isSigned: false}, iterations);
+}
+
+function decodeAll(openjpeg, iterations) {
   decodeFile(openjpeg, 'CT1', iterations)
   decodeFile(openjpeg, 'CT2', iterations)
   decodeFile(openjpeg, 'MG1', iterations)
@@ -56,10 +191,8 @@ function main(openjpeg) {
   decodeFile(openjpeg, 'XA1', iterations)
 }
 
-if(openjpegjs) {
-  //console.log('testing openjpegjs...');
-  openjpegjs().then(function(openjpeg) {
-    main(openjpeg);
-  });
-}
+//console.log('testing openjpegjs...');
+loadOpenJPEG().then(function(openjpeg) {
+  main(openjpeg);
+});
 